@@ -8,10 +8,16 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
 #include <termios.h>
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
 #include <cctype>
 #include <cstring>
 #include <cerrno>
@@ -21,6 +27,13 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <iterator>
+#include <thread>
+#include <chrono>
 
 //==========================================================================================================
 /**** Declarations & Constants ****/
@@ -29,6 +42,13 @@ constexpr int ctrl_key(int k) { return k & 0x1f; }  // 0x1f + k is similar to ct
 constexpr const char* VERSION = "1.0";
 constexpr int TAB_SIZE = 8;           // Except the tabs to not function properly, i'm not resolving the problem rn
 constexpr int QUIT_TIMES = 3;         //how many times should the user enter the quit key to leave the program with unsaved changes
+constexpr int BLOCK_EDIT_THREAD_ROWS = 4096; // a block edit only gets split across threads once each thread has at least this many rows
+constexpr int COLD_BLOCK_ROWS = 512;    // how many rows get compressed together into one cold block
+constexpr int COLD_MIN_RUN = 8;         // runs of stale rows shorter than this aren't worth a block of their own
+constexpr unsigned COLD_AFTER_FRAMES = 64;  // a row that hasn't been drawn or edited for this many frames is cold
+constexpr int RELOAD_DIFF_LIMIT = 1024; // max edit distance (in lines) the reload diff searches before replacing the whole changed region
+constexpr size_t FENWICK_GROUP = 64;   // rows per node of the prefix-sum trees, the rest of a group is summed row by row
+constexpr int FOLD_SEARCH_ROWS = 100000; // how far up toggling a fold looks for the row that starts the enclosing one
 
 enum class Key : int
 {
@@ -42,18 +62,213 @@ enum class Key : int
     PAGE_DOWN,
     HOME_KEY,
     END_KEY,
+    SHIFT_ARROW_LEFT,
+    SHIFT_ARROW_DOWN,
+    SHIFT_ARROW_UP,
+    SHIFT_ARROW_RIGHT,
     NONE = 0
 };
 
 //==========================================================================================================
 /**** Forward Declarations ***/
 //==========================================================================================================
+class SessionRecorder;
+class SessionPlayer;
 class Terminal;
 class EditorRow;
 class AppendBuffer;
+class FileWatcher;
+class LzCodec;
+class FenwickTree;
+class FoldIndex;
+class FoldView;
 class TextBuffer;
+class Window;
 class Editor;
 
+//==========================================================================================================
+/**** Varints (LEB128), used by the session files and the cold row codec ****/
+//==========================================================================================================
+static void put_varint(std::string& out, size_t v)
+{
+    while (v >= 0x80) 
+    {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static size_t get_varint(std::string_view in, size_t& pos)
+{
+    size_t v = 0;
+    for (int shift = 0; pos < in.size(); shift += 7) 
+    {
+        unsigned char b = in[pos++];
+        v |= (size_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
+//==========================================================================================================
+/**** Session recording & replay ****/
+//==========================================================================================================
+// A session file is SESSION_MAGIC, the terminal size (2 varints: rows, cols), then records. Every record
+// starts with a type byte and the microseconds since the previous record (varint):
+//   'K' <byte>                   one raw input byte, as read by Terminal::read_key
+//   'F' <refresh us> <bytes>     one refresh_screen: how long it took and how much it wrote (varints)
+constexpr const char* SESSION_MAGIC = "TEDSESS1";
+
+class SessionRecorder
+{
+private:
+    std::ofstream out;
+    std::chrono::steady_clock::time_point started, last;
+    
+    // <when> can be behind <last> when replayed keys keep their recorded times but a fast replay got ahead
+    // of them, such records just get a 0 delta
+    void begin_record(char type, std::string& rec, std::chrono::steady_clock::time_point when)
+    {
+        rec.push_back(type);
+        put_varint(rec, std::max<long>(0, std::chrono::duration_cast<std::chrono::microseconds>(when - last).count()));
+        last = std::max(last, when);
+    }
+    
+    void key_byte_at(char c, std::chrono::steady_clock::time_point when)
+    {
+        std::string rec;
+        begin_record('K', rec, when);
+        rec.push_back(c);
+        out.write(rec.data(), rec.size());
+    }
+    
+public:
+    void open(const std::string& path, int rows, int cols)
+    {
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) 
+        {
+            throw std::runtime_error(std::string("Can't open session file: ") + std::strerror(errno));
+        }
+        std::string header(SESSION_MAGIC);
+        put_varint(header, rows);
+        put_varint(header, cols);
+        out.write(header.data(), header.size());
+        started = last = std::chrono::steady_clock::now();
+    }
+    
+    bool is_open() const { return out.is_open(); }
+    
+    void key_byte(char c) { key_byte_at(c, std::chrono::steady_clock::now()); }
+    
+    // a byte coming from a replayed session keeps the time it was originally typed at (<at_us> since the
+    // start), so re-recording a --fast replay doesn't squash its timing to nothing
+    void key_byte(char c, long at_us) { key_byte_at(c, started + std::chrono::microseconds(at_us)); }
+    
+    void frame(long refresh_us, size_t bytes)
+    {
+        std::string rec;
+        begin_record('F', rec, std::chrono::steady_clock::now());
+        put_varint(rec, refresh_us);
+        put_varint(rec, bytes);
+        out.write(rec.data(), rec.size());
+        out.flush();  // once per refresh, so a crash or a kill -9 still leaves everything up to the last frame on disk
+    }
+};
+
+class SessionPlayer
+{
+private:
+    struct KeyEvent
+    {
+        long at_us;  // since the start of the recording
+        char byte;
+    };
+    std::vector<KeyEvent> keys;
+    std::vector<long> recorded_frames_us;  // the refresh times of the recorded session, to compare against
+    size_t next;
+    bool active, fast;
+    int rows, cols;
+    std::chrono::steady_clock::time_point start;
+    
+    std::chrono::steady_clock::time_point due(const KeyEvent& key) const
+    {
+        return start + std::chrono::microseconds(key.at_us);
+    }
+    
+public:
+    SessionPlayer() : next(0), active(false), fast(false), rows(0), cols(0) {}
+    
+    void load(const std::string& path, bool as_fast_as_possible)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) 
+        {
+            throw std::runtime_error(std::string("Can't open session file: ") + std::strerror(errno));
+        }
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t magic_len = std::strlen(SESSION_MAGIC);
+        if (data.compare(0, magic_len, SESSION_MAGIC) != 0) 
+        {
+            throw std::runtime_error("Not a session file: " + path);
+        }
+        
+        size_t pos = magic_len;
+        rows = (int)get_varint(data, pos);
+        cols = (int)get_varint(data, pos);
+        long at = 0;
+        while (pos < data.size()) 
+        {
+            char type = data[pos++];
+            at += (long)get_varint(data, pos);
+            if (type == 'K' && pos < data.size()) 
+            {
+                keys.push_back({at, data[pos++]});
+            }
+            else if (type == 'F') 
+            {
+                recorded_frames_us.push_back((long)get_varint(data, pos));
+                get_varint(data, pos);
+            }
+            else break;  // truncated or corrupt, replay what we have
+        }
+        active = true;
+        fast = as_fast_as_possible;
+        start = std::chrono::steady_clock::now();
+    }
+    
+    bool is_active() const { return active; }
+    int get_rows() const { return rows; }
+    int get_cols() const { return cols; }
+    size_t get_key_count() const { return keys.size(); }
+    const std::vector<long>& get_recorded_frames() const { return recorded_frames_us; }
+    
+    // how long until the next byte is due, -1 once the session is over (-1 is "forever" to poll())
+    int ms_until_next() const
+    {
+        if (next >= keys.size()) return -1;
+        if (fast) return 0;
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due(keys[next]) - std::chrono::steady_clock::now());
+        return (int)std::max<long>(0, wait.count());
+    }
+    
+    // Same contract as read(): 1 when a byte was read, 0 on a VTIME timeout. <wait> is false for the bytes
+    // after an <esc>, where the terminal would give up after 0.1s: if the recorded gap was longer than
+    // that, the escape was typed on its own and we time out here too.
+    int read_byte(char* c, bool wait)
+    {
+        if (next >= keys.size()) throw std::runtime_error("User quit");  // the session is over
+        if (!wait && next > 0 && keys[next].at_us - keys[next - 1].at_us > 100000) return 0;
+        
+        if (!fast) std::this_thread::sleep_until(due(keys[next]));
+        *c = keys[next++].byte;
+        return 1;
+    }
+    
+    long last_key_us() const { return next ? keys[next - 1].at_us : 0; }  // when the last byte read was typed
+};
+
 //==========================================================================================================
 /**** Terminal Class ****/
 //==========================================================================================================
@@ -64,9 +279,28 @@ private:
     int screen_rows;
     int screen_cols;
     bool raw_mode_active;
+    SessionRecorder* recorder;  // logs every input byte, when recording
+    SessionPlayer* player;      // replaces stdin, when replaying
+    
+    int read_byte(char* c, bool wait)  // every input byte comes through here, see SessionPlayer::read_byte
+    {
+        int nread = player ? player->read_byte(c, wait) : read(STDIN_FILENO, c, 1);
+        if (nread == 1 && recorder) 
+        {
+            if (player) recorder->key_byte(*c, player->last_key_us());
+            else recorder->key_byte(*c);
+        }
+        return nread;
+    }
     
 public:
-    Terminal() : screen_rows(0), screen_cols(0), raw_mode_active(false) {}
+    Terminal() : screen_rows(0), screen_cols(0), raw_mode_active(false), recorder(nullptr), player(nullptr) {}
+    
+    void attach_session(SessionRecorder* rec, SessionPlayer* play)
+    {
+        recorder = rec;
+        player = play;
+    }
           
     void exit_raw_mode() 
     {
@@ -91,6 +325,8 @@ public:
     
     void enter_raw_mode() 
     {
+        if (player && !isatty(STDIN_FILENO)) return;  // a replay doesn't need a keyboard (e.g. running in a script)
+        
         // Read the terminal Attributes
         if (tcgetattr(STDIN_FILENO, &og_termios) == -1) {
             throw std::runtime_error(std::string("tcsetattr error: ") + std::strerror(errno));
@@ -110,12 +346,36 @@ public:
         }
     }
     
+    // blocks until either stdin or one of other_fds is readable; returns true when there's a key to read
+    // (negative fds are ignored by poll(), so with none of them this just waits for stdin)
+    bool wait_for_input(const std::vector<int>& other_fds)
+    {
+        std::vector<pollfd> fds;
+        fds.push_back({ STDIN_FILENO, POLLIN, 0 });
+        for (int fd : other_fds) { fds.push_back({ fd, POLLIN, 0 }); }
+        
+        if (player)  // while replaying, "input" is ready once the next recorded byte is due
+        {
+            int timeout = player->ms_until_next();
+            if (timeout < 0) return true;  // over, read_key will end the session
+            return poll(fds.data() + 1, fds.size() - 1, timeout) <= 0;
+        }
+        
+        while (poll(fds.data(), fds.size(), -1) == -1)
+        {
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("poll error: ") + std::strerror(errno));
+            }
+        }
+        return fds[0].revents & POLLIN || std::none_of(fds.begin() + 1, fds.end(), [](const pollfd& fd) { return fd.revents & POLLIN; });
+    }
+
     int read_key()  // read_key()'s job is to wait for one keypress, and return it
     {
         int nread; 
         char c;    
                     
-        while ((nread = read(STDIN_FILENO, &c, 1)) != 1) 
+        while ((nread = read_byte(&c, true)) != 1) 
         {
             if (nread == -1 && errno != EAGAIN) {
                 throw std::runtime_error(std::string("Read error:") + std::strerror(errno));
@@ -127,17 +387,33 @@ public:
             char seq[3];
 
             // we don't want to perform any action when the esc key is read (that is just the '\x1b'), so just return the blank \x1b
-            if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';            
-            if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+            if (read_byte(&seq[0], false) != 1) return '\x1b';            
+            if (read_byte(&seq[1], false) != 1) return '\x1b';
 
 
             if (seq[0] == '[') 
             {      
                 if (seq[1] >= '0' && seq[1] <= '9')  // check if the entered sequence represents the pageup/down, home, or end keys
                 {
-                    if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                    if (read_byte(&seq[2], false) != 1) return '\x1b';
                     
-                    if (seq[2] == '~') 
+                    if (seq[1] == '1' && seq[2] == ';')  // modified arrow keys: <esc>[1;<modifier><A-D>
+                    {
+                        char mod[2];
+                        if (read_byte(&mod[0], false) != 1) return '\x1b';
+                        if (read_byte(&mod[1], false) != 1) return '\x1b';
+                        if (mod[0] == '2')  // shift
+                        {
+                            switch (mod[1]) 
+                            {
+                                case 'A': return (int)Key::SHIFT_ARROW_UP;
+                                case 'B': return (int)Key::SHIFT_ARROW_DOWN;
+                                case 'C': return (int)Key::SHIFT_ARROW_RIGHT;
+                                case 'D': return (int)Key::SHIFT_ARROW_LEFT;
+                            }
+                        }
+                    }
+                    else if (seq[2] == '~') 
                     {
                         switch (seq[1]) 
                         {
@@ -179,6 +455,12 @@ public:
     
     bool get_window_size() 
     {
+        if (player)  // a replay draws at the size it was recorded at, so the frames are the same
+        {
+            screen_rows = player->get_rows();
+            screen_cols = player->get_cols();
+            return true;
+        }
         winsize ws; 
         if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) 
         {
@@ -225,6 +507,172 @@ public:
     size_t length() const { return buffer.size(); }     // return the string size
 };
 
+//==========================================================================================================
+/**** FileWatcher Class (inotify) ****/
+//==========================================================================================================
+class FileWatcher
+{
+private:
+    int fd;              // the inotify instance, -1 when nothing is being watched
+    std::string name;    // the basename of the watched file inside the watched directory
+
+public:
+    FileWatcher() : fd(-1) {}
+
+    ~FileWatcher()
+    {
+        if (fd != -1) close(fd);
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // We watch the parent directory rather than the file itself, so that tools which save by writing a
+    // temp file and renaming it over ours (a new inode) are still noticed
+    void watch(const std::string& file_name)
+    {
+        if (fd != -1) { close(fd); fd = -1; }
+
+        size_t slash = file_name.rfind('/');
+        std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : file_name.substr(0, slash));
+        name = (slash == std::string::npos) ? file_name : file_name.substr(slash + 1);
+
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1) return;  // no inotify -> no change detection, the editor still works
+
+        if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // drains all pending events, returns true if any of them were about our file
+    bool consume_events()
+    {
+        if (fd == -1) return false;
+
+        alignas(inotify_event) char buf[4096];
+        bool touched = false;
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0)
+        {
+            for (char* p = buf; p < buf + len; )
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                if (event->len && name == event->name) { touched = true; }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        return touched;
+    }
+
+    int get_fd() const { return fd; }
+};
+
+//==========================================================================================================
+/**** LzCodec Class (compression for cold rows) ****/
+//==========================================================================================================
+// A tiny LZ77 codec. The stream is the original size, then a list of sequences:
+// <literal count><literals>[<match length - MIN_MATCH><16 bit offset back into the output>]
+// the last sequence has no match. All counts are varints.
+class LzCodec
+{
+private:
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr int HASH_BITS = 12;
+    
+public:
+    static std::string compress(std::string_view in)
+    {
+        std::string out;
+        put_varint(out, in.size());
+        
+        std::vector<int> table(1 << HASH_BITS, -1);  // hash of 4 bytes -> where we last saw them
+        size_t anchor = 0, i = 0;
+        while (i + MIN_MATCH <= in.size()) 
+        {
+            uint32_t seq;
+            std::memcpy(&seq, in.data() + i, sizeof(seq));
+            uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+            int candidate = table[h];
+            table[h] = (int)i;
+            
+            if (candidate >= 0 && i - candidate <= 0xFFFF && std::memcmp(in.data() + candidate, in.data() + i, MIN_MATCH) == 0) 
+            {
+                size_t len = MIN_MATCH;
+                while (i + len < in.size() && in[candidate + len] == in[i + len]) { len++; }
+                
+                size_t offset = i - candidate;
+                put_varint(out, i - anchor);
+                out.append(in.substr(anchor, i - anchor));
+                put_varint(out, len - MIN_MATCH);
+                out.push_back((char)(offset & 0xff));
+                out.push_back((char)(offset >> 8));
+                i += len;
+                anchor = i;
+            }
+            else
+            {
+                i++;
+            }
+        }
+        put_varint(out, in.size() - anchor);
+        out.append(in.substr(anchor));
+        return out;
+    }
+    
+    static std::string decompress(std::string_view in)
+    {
+        size_t pos = 0;
+        size_t size = get_varint(in, pos);
+        std::string out;
+        out.reserve(size);
+        
+        while (pos < in.size()) 
+        {
+            size_t literals = get_varint(in, pos);
+            out.append(in.substr(pos, literals));
+            pos += literals;
+            if (out.size() >= size || pos + 2 > in.size()) break;
+            
+            size_t len = get_varint(in, pos) + MIN_MATCH;
+            size_t offset = (unsigned char)in[pos] | ((unsigned char)in[pos + 1] << 8);
+            pos += 2;
+            size_t from = out.size() - offset;
+            for (size_t k = 0; k < len; k++) { out.push_back(out[from + k]); }  // byte by byte, matches may overlap
+        }
+        return out;
+    }
+};
+
+// A run of rows compressed together. Each line is stored as its length (varint) and then its bytes, rather than
+// split on '\n': a row can hold a '\n' itself (ctrl-J types one).
+struct ColdBlock
+{
+    std::string data;
+    size_t raw_size;
+    int live_rows;   // rows still cold in it, the block goes once this drops to 0
+    
+    static void pack_line(std::string& text, std::string_view line)
+    {
+        put_varint(text, line.size());
+        text.append(line);
+    }
+    
+    static std::vector<std::string_view> unpack_lines(std::string_view text)
+    {
+        std::vector<std::string_view> lines;
+        for (size_t pos = 0; pos < text.size(); ) 
+        {
+            size_t len = get_varint(text, pos);
+            lines.push_back(text.substr(pos, len));
+            pos += len;
+        }
+        return lines;
+    }
+};
+
 //==========================================================================================================
 /**** EditorRow Class ****/
 //==========================================================================================================
@@ -233,6 +681,8 @@ class EditorRow
 private:
     std::string chars;  
     std::string render;    
+    unsigned last_used = 0;                 // the TextBuffer frame this row was last drawn or edited in
+
     void update_render() 
     {
         render.clear();
@@ -285,6 +735,24 @@ public:
         update_render();
     }
     
+    void replace(int at, int len, const std::string& s)  // replace <len> chars starting at <at> with <s>
+    {
+        if (at < 0 || at > (int)chars.size()) { return; }
+        chars.replace(at, len, s);
+        update_render();
+    }
+    
+    int cx_to_rx(int cx) const  // converts an index into chars to the matching index into render (tabs expand)
+    {
+        int rx = 0;
+        for (int j = 0; j < cx && j < (int)chars.size(); j++) 
+        {
+            if (chars[j] == '\t') { rx += (TAB_SIZE - 1) - (rx % TAB_SIZE); }
+            rx++;
+        }
+        return rx + std::max(0, cx - (int)chars.size());
+    }
+    
     void truncate(int len)
     {
         if (len < (int)chars.size()) {
@@ -293,6 +761,9 @@ public:
         }
     }
     
+    void mark_used(unsigned frame) { last_used = frame; }
+    unsigned get_last_used() const { return last_used; }
+    
     int get_size() const { return (int)chars.size(); }
     int get_render_size() const { return (int)render.size(); }
     const char* get_chars() const { return chars.c_str(); }
@@ -301,136 +772,1619 @@ public:
 };
 
 //==========================================================================================================
-/**** TextBuffer Class ****/
+/**** FenwickTree Class (prefix sums over rows) ****/
 //==========================================================================================================
-class TextBuffer 
+// A binary indexed tree over one number per row: point updates, prefix sums and "which row holds the n-th unit"
+// in O(log n). The tree only has a node per FENWICK_GROUP rows, the last partial group is summed from the values
+// directly, which keeps the tree itself to a fraction of a byte per row. Inserting or removing a row can't be
+// done in place, so it only marks the nodes from that row's group on as stale; the next query that reaches them
+// rebuilds just that suffix, which costs about as much as the std::vector insert/erase of the row itself.
+class FenwickTree
 {
 private:
-    std::vector<EditorRow> rows;
-    int changes;
-    std::string filename;    
-public:
-    TextBuffer() : changes(0) {}
+    std::vector<int> values;      // the per-row numbers
+    std::vector<long long> tree;  // 1-based over groups, tree[i] holds the sum of groups (i - lowbit(i), i]
+    size_t stale_from;            // tree[i] for i >= stale_from needs rebuilding
     
+    static size_t lowbit(size_t i) { return i & (~i + 1); }
     
-    void insert_row(int at, const std::string& s) 
+    size_t groups() const { return (values.size() + FENWICK_GROUP - 1) / FENWICK_GROUP; }
+    
+    void resize_tree()
     {
-        if (at < 0 || at > (int)rows.size()) { return; }
-        // std::vector handles reallocation (realloc) and shifting (memmove)
-        rows.insert(rows.begin() + at, EditorRow(s));
-        changes++;
+        tree.resize(groups() + 1, 0);
     }
     
-    void insert_char(int row, int col, int c) 
+    void rebuild()
     {
-        if (row < 0 || row >= (int)rows.size()) { return; }
-        rows[row].insert_char(col, c);
-        changes++;
+        size_t n = groups();
+        if (stale_from > n) return;
+        
+        for (size_t i = stale_from; i <= n; i++) 
+        {
+            size_t from = (i - 1) * FENWICK_GROUP, to = std::min(from + FENWICK_GROUP, values.size());
+            tree[i] = 0;
+            for (size_t j = from; j < to; j++) { tree[i] += values[j]; }
+        }
+        // the (still valid) nodes that make up the prefix before stale_from are exactly the ones whose parent is stale
+        for (size_t i = stale_from - 1; i > 0; i -= lowbit(i)) 
+        {
+            if (i + lowbit(i) <= n) tree[i + lowbit(i)] += tree[i];
+        }
+        for (size_t i = stale_from; i <= n; i++) 
+        {
+            if (i + lowbit(i) <= n) tree[i + lowbit(i)] += tree[i];
+        }
+        stale_from = n + 1;
     }
     
-    void delete_char(int row, int col) 
+public:
+    FenwickTree() : tree(1, 0), stale_from(1) {}
+    
+    void assign(std::vector<int> all)  // replaces everything, O(n)
     {
-        if (row < 0 || row >= (int)rows.size()) { return; }
-        rows[row].delete_char(col);
-        changes++;
+        values = std::move(all);
+        tree.assign(groups() + 1, 0);
+        stale_from = 1;
     }
     
-    // Logic for splitting a line (Enter key)
-    void split_row(int row_idx, int split_at)
+    void insert(int at, const std::vector<int>& added)
     {
-         if (row_idx < 0 || row_idx >= (int)rows.size()) return;
-         EditorRow& current_row = rows[row_idx];
-         std::string row_content = current_row.get_chars_str();
-         std::string next_row_content = "";
-         
-         if(split_at < (int)row_content.size()) {
-             next_row_content = row_content.substr(split_at);
-             current_row.truncate(split_at);
-         }
-         insert_row(row_idx + 1, next_row_content);
+        values.insert(values.begin() + at, added.begin(), added.end());
+        resize_tree();
+        stale_from = std::min(stale_from, (size_t)at / FENWICK_GROUP + 1);
     }
     
-    // Logic for appending a line to previous (Backspace at start of line)
-    void merge_rows(int row_idx)
+    void insert(int at, int value) { insert(at, std::vector<int>(1, value)); }
+    
+    void erase(int at, int count = 1)
     {
-        if (row_idx <= 0 || row_idx >= (int)rows.size()) return;
-        EditorRow& prev_row = rows[row_idx - 1];
-        EditorRow& curr_row = rows[row_idx];
-        prev_row.append_string(curr_row.get_chars_str());
-        
-        // Remove the current row
-        rows.erase(rows.begin() + row_idx);
-        changes++;
+        values.erase(values.begin() + at, values.begin() + at + count);
+        resize_tree();
+        stale_from = std::min(stale_from, (size_t)at / FENWICK_GROUP + 1);
     }
     
-    void open_file(const std::string& file_name) 
+    void set(int at, int value)
     {
-        filename = file_name;
-        std::ifstream file(file_name);
-        if (!file.is_open()) 
-        {
-            throw std::runtime_error(std::string("File Read Error:") + std::strerror(errno));
-        }
-        std::string line;
-        
-        // Clear existing rows if any
-        rows.clear();
-        while (std::getline(file, line)) 
-        {
-            // Remove \r if present 
-            if (!line.empty() && line.back() == '\r') {
-                line.pop_back();
-            }
-            insert_row(rows.size(), line);
-        }
-        file.close();
-        changes = 0;
+        long long delta = value - values[at];
+        values[at] = value;
+        size_t group = (size_t)at / FENWICK_GROUP + 1;
+        if (group >= stale_from) return;  // the rebuild will pick it up
+        for (size_t i = group; i < stale_from; i += lowbit(i)) { tree[i] += delta; }
     }
     
-    std::string rows_to_string() const // reads the row of the files and converts them into strings
+    // sets values [from, to), one update at a time for a few rows, else in bulk with the suffix rebuilt lazily
+    void set_range(int from, int to, int value)
     {
-        std::stringstream ss;
-        for (const auto& row : rows) 
+        size_t log_n = 1;
+        while (((size_t)1 << log_n) < values.size()) log_n++;
+        if ((size_t)(to - from) * log_n < values.size() - from)
         {
-            ss << row.get_chars_str() << '\n';
+            for (int i = from; i < to; i++) set(i, value);
+            return;
         }
-        return ss.str();
+        std::fill(values.begin() + from, values.begin() + to, value);
+        stale_from = std::min(stale_from, (size_t)from / FENWICK_GROUP + 1);
     }
     
-    bool save() 
+    int get(int at) const { return values[at]; }
+    
+    long long prefix(int count)  // the sum of the first <count> values
     {
-        if (filename.empty()) return false;
-        std::string buffer_content = rows_to_string();
-        // open the <filename> with read/write perms, or create it, if it doesn't' exit
-        int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644); 
-        
-        if (fd != -1) 
+        size_t whole = (size_t)count / FENWICK_GROUP;
+        if (whole >= stale_from) rebuild();
+        long long sum = 0;
+        for (size_t i = whole; i > 0; i -= lowbit(i)) { sum += tree[i]; }
+        for (size_t j = whole * FENWICK_GROUP; j < (size_t)count; j++) { sum += values[j]; }
+        return sum;
+    }
+    
+    long long total() { return prefix((int)values.size()); }
+    
+    // the index whose value holds unit number <target> (0 based), i.e. the first i with prefix(i + 1) > target;
+    // size() if target is past the end
+    int find(long long target)
+    {
+        rebuild();
+        size_t n = groups(), pos = 0, step = 1;
+        while (step * 2 <= n) step *= 2;
+        for (; step; step /= 2) 
         {
-            if (ftruncate(fd, buffer_content.size()) != -1) 
+            if (pos + step <= n && tree[pos + step] <= target) 
+            {
+                pos += step;
+                target -= tree[pos];
+            }
+        }
+        size_t i = pos * FENWICK_GROUP;
+        while (i < values.size() && values[i] <= target) { target -= values[i++]; }
+        return (int)i;
+    }
+};
+
+//==========================================================================================================
+/**** FoldIndex Class ****/
+//==========================================================================================================
+// Indentation based folding. A row starts a fold when the next non-blank row is indented deeper; the fold runs
+// until the next non-blank row that isn't, and takes that row too if it closes a bracket the first row opened
+// ("key": {  ...  }). The index only keeps each row's shape (indent and brackets), updated row by row as the
+// text changes. Which folds are closed is up to each window (FoldView), so the index also knows the views on
+// it; the TextBuffer tells them about the rows its edits insert, erase or reshape.
+class FoldIndex
+{
+public:
+    struct RowShape
+    {
+        int16_t indent;  // in columns (capped at INT16_MAX), -1 for a blank row
+        char opener;     // '{' or '[' if the row ends with one
+        char closer;     // '}' or ']' if the row starts with one
+        
+        bool operator!=(const RowShape& other) const { return indent != other.indent || opener != other.opener || closer != other.closer; }
+    };
+    
+private:
+    std::vector<RowShape> shapes;
+    std::vector<FoldView*> views;  // the windows' fold states on these rows
+    
+    int next_non_blank(int row) const
+    {
+        while (row < (int)shapes.size() && shapes[row].indent < 0) row++;
+        return row;
+    }
+    
+    // a row that starts with a closing bracket ends a fold, it only starts one too if it opens another ("} else {"),
+    // that way folds always nest
+    static bool can_open(const RowShape& shape) { return !shape.closer || shape.opener; }
+    
+    // <row> is the "}" that ends the fold started by <header> (a "} else {" row starts a fold of its own instead)
+    bool closes(int header, int row) const
+    {
+        const RowShape& a = shapes[header];
+        const RowShape& b = shapes[row];
+        return a.opener && !b.opener && b.indent == a.indent && b.closer == (a.opener == '{' ? '}' : ']');
+    }
+    
+public:
+    FoldIndex() = default;
+    
+    // Another buffer's rows moved into this one (see Editor::load_buffer): the windows on us stay attached
+    FoldIndex& operator=(FoldIndex&& other)
+    {
+        shapes = std::move(other.shapes);
+        return *this;
+    }
+    
+    static RowShape shape_of(std::string_view text)
+    {
+        RowShape shape{0, 0, 0};
+        size_t i = 0;
+        int indent = 0;
+        for (; i < text.size() && (text[i] == ' ' || text[i] == '\t'); i++) 
+        {
+            indent = (text[i] == '\t') ? (indent / TAB_SIZE + 1) * TAB_SIZE : indent + 1;
+        }
+        shape.indent = (int16_t)std::min(indent, (int)INT16_MAX);
+        size_t last = text.find_last_not_of(" \t");
+        if (i == text.size() || last == std::string_view::npos) 
+        {
+            shape.indent = -1;
+            return shape;
+        }
+        if (text[last] == '{' || text[last] == '[') shape.opener = text[last];
+        if (text[i] == '}' || text[i] == ']') shape.closer = text[i];
+        return shape;
+    }
+    
+    void assign(std::vector<RowShape> all) { shapes = std::move(all); }
+    
+    void insert(int at, const std::vector<RowShape>& added) { shapes.insert(shapes.begin() + at, added.begin(), added.end()); }
+    
+    void erase(int at, int count) { shapes.erase(shapes.begin() + at, shapes.begin() + at + count); }
+    
+    void update(int row, const RowShape& shape) { shapes[row] = shape; }
+    
+    const RowShape& shape(int row) const { return shapes[row]; }
+    int size() const { return (int)shapes.size(); }
+    
+    void attach(FoldView* view) { views.push_back(view); }
+    void detach(FoldView* view) { views.erase(std::remove(views.begin(), views.end(), view), views.end()); }
+    const std::vector<FoldView*>& get_views() const { return views; }
+    
+    bool is_fold(int row) const
+    {
+        if (row < 0 || row >= (int)shapes.size() || shapes[row].indent < 0) return false;
+        if (!can_open(shapes[row])) return false;
+        int next = next_non_blank(row + 1);
+        return next < (int)shapes.size() && shapes[next].indent > shapes[row].indent;
+    }
+    
+    // the last row of the fold starting at <row> (<row> itself if it doesn't start one)
+    int fold_end(int row) const
+    {
+        if (!is_fold(row)) return row;
+        int indent = shapes[row].indent;
+        int end = row, r = row + 1;
+        while ((r = next_non_blank(r)) < (int)shapes.size() && shapes[r].indent > indent) { end = r++; }
+        
+        if (r < (int)shapes.size() && closes(row, r)) end = r;  // the closing bracket goes with the fold
+        return end;
+    }
+    
+    // The fold a row belongs to: its own if it starts one, else the nearest enclosing one; -1 if none (or if it
+    // starts more than FOLD_SEARCH_ROWS up). That's the closest row above that's indented less (or the row
+    // opening the bracket this one closes), since everything in between is indented deeper. If that row can't
+    // start a fold itself (a "}", or a "{" closed right away), ours is whatever fold encloses that row.
+    int fold_at(int row) const
+    {
+        if (is_fold(row)) return row;
+        int probe = next_non_blank(row);  // a blank row goes with the row after it
+        if (probe >= (int)shapes.size()) return -1;
+        
+        bool past_sibling = false;  // a row as indented as <probe> is in between, so no bracket of <probe> is closed above
+        for (int r = row - 1; r >= std::max(0, row - FOLD_SEARCH_ROWS); r--) 
+        {
+            const RowShape& shape = shapes[probe];
+            if (shape.indent == 0 && (!shape.closer || past_sibling)) return -1;  // top level, nothing can enclose it
+            
+            int indent = shapes[r].indent;
+            if (indent < 0 || indent > shape.indent) continue;
+            if (indent < shape.indent || (!past_sibling && closes(r, probe))) 
+            {
+                if (is_fold(r)) return r;
+                probe = r;
+                past_sibling = true;  // the fold <r> closes (if any) ends at <r>, only a less indented row can be ours
+            }
+            else past_sibling = true;
+        }
+        return -1;
+    }
+    
+    // Which rows stay shown once every fold is closed (<shown>, 1 or 0 per row) and which rows start a fold
+    // (<folds>), in one pass over the row shapes with a stack of the folds we're in. A row is known to start a
+    // fold once the next non-blank row turns out deeper; blank rows are settled by the next non-blank one too,
+    // they're hidden only if the fold goes on past them.
+    // This is O(n): whether a row is top level depends on the least indented row anywhere above it, so a single
+    // edit can change it for every row that follows, and a "what's left after closing everything" list couldn't
+    // be kept up to date locally. The pass only reads the cached shapes (no row text, no cold blocks), so it's
+    // well under a second even at 10M rows.
+    void close_all(std::vector<char>& folds, std::vector<int>& shown) const
+    {
+        int n = (int)shapes.size();
+        folds.assign(n, 0);
+        shown.assign(n, 1);
+        std::vector<int> open;  // first rows of the enclosing folds, innermost last
+        int prev = -1, blanks_from = 0;  // the last non-blank row
+        for (int r = 0; r < n; r++) 
+        {
+            const RowShape& shape = shapes[r];
+            if (shape.indent < 0) continue;
+            
+            if (prev >= 0 && shape.indent > shapes[prev].indent && can_open(shapes[prev])) 
+            {
+                folds[prev] = 1;
+                open.push_back(prev);
+            }
+            bool closing = false;
+            while (!open.empty() && shape.indent <= shapes[open.back()].indent && !closing) 
+            {
+                closing = closes(open.back(), r);
+                open.pop_back();
+            }
+            int flag = (closing || !open.empty()) ? 0 : 1;
+            std::fill(shown.begin() + blanks_from, shown.begin() + r + 1, flag);
+            blanks_from = r + 1;
+            prev = r;
+        }
+    }
+};
+
+//==========================================================================================================
+/**** FoldView Class ****/
+//==========================================================================================================
+// The folds one window has closed, over the shapes in its buffer's FoldIndex: a flag per row, plus a prefix-sum
+// tree of which rows are shown, so mapping between file rows and screen rows is O(log n). Both only exist once
+// the window closes a fold, a window that never folds costs nothing per row. Opening or closing one fold only
+// touches its rows; closing all of them is a linear pass, see FoldIndex::close_all.
+// Edits made through any window reach every view: new rows, erased rows and rows whose shape changes open the
+// closed folds they're in, since those folds may no longer match the text.
+class FoldView
+{
+private:
+    FoldIndex* index;
+    std::vector<char> collapsed;  // per row: it's a fold that's currently closed. Empty while nothing is.
+    FenwickTree visible;          // per row: 1 if shown, 0 if inside a closed fold. Empty along with <collapsed>.
+    
+    bool folding() const { return !collapsed.empty(); }
+    
+    void start_folding()
+    {
+        if (folding()) return;
+        collapsed.assign(index->size(), 0);
+        visible.assign(std::vector<int>(index->size(), 1));
+    }
+    
+    // shows the rows of the fold, except those inside folds nested in it that are still closed
+    void show_fold(int row)
+    {
+        int end = index->fold_end(row);
+        for (int r = row + 1; r <= end; ) 
+        {
+            int run_end = r;
+            while (run_end <= end && !collapsed[run_end]) run_end++;
+            int show_to = std::min(run_end + 1, end + 1);  // a closed nested fold's own first row is shown
+            visible.set_range(r, show_to, 1);
+            r = (run_end <= end) ? index->fold_end(run_end) + 1 : end + 1;
+        }
+    }
+    
+public:
+    explicit FoldView(FoldIndex* folds) : index(folds) { index->attach(this); }
+    FoldView(const FoldView& other) : index(other.index), collapsed(other.collapsed), visible(other.visible) { index->attach(this); }
+    FoldView& operator=(const FoldView&) = delete;
+    ~FoldView() { index->detach(this); }
+    
+    void show(FoldIndex* folds)  // switch to another buffer's rows, with nothing folded
+    {
+        index->detach(this);
+        index = folds;
+        index->attach(this);
+        expand_all();
+    }
+    
+    int fold_at(int row) const { return index->fold_at(row); }
+    
+    bool is_collapsed(int row) const { return folding() && row >= 0 && row < (int)collapsed.size() && collapsed[row]; }
+    bool is_visible(int row) { return !folding() || row >= (int)collapsed.size() || visible.get(row); }
+    
+    void collapse(int row)
+    {
+        if (!index->is_fold(row) || is_collapsed(row)) return;
+        start_folding();
+        collapsed[row] = 1;
+        visible.set_range(row + 1, index->fold_end(row) + 1, 0);
+    }
+    
+    void expand(int row)
+    {
+        if (!is_collapsed(row)) return;
+        collapsed[row] = 0;
+        if (visible.get(row)) show_fold(row);  // inside another closed fold, it stays hidden with it
+    }
+    
+    // open whatever closed folds hide <row>, so it can be edited
+    void reveal(int row)
+    {
+        while (!is_visible(row)) 
+        {
+            int header = prev_visible(row);  // the first row of the outermost closed fold around <row>
+            if (header < 0 || !collapsed[header]) 
+            {
+                visible.set(row, 1);  // edits moved the fold's end from under it, just show the row
+                break;
+            }
+            expand(header);
+        }
+        if (is_collapsed(row)) expand(row);
+    }
+    
+    void collapse_all()
+    {
+        std::vector<int> shown;
+        index->close_all(collapsed, shown);
+        visible.assign(std::move(shown));
+    }
+    
+    void expand_all()  // back to no per row state at all
+    {
+        std::vector<char>().swap(collapsed);
+        visible.assign(std::vector<int>());
+    }
+    
+    // The TextBuffer's edits, each called before the shapes in the index change
+    void insert_rows(int at, int count)
+    {
+        if (!folding()) return;
+        reveal(at);  // the new rows would land inside a closed fold
+        if (is_collapsed(at - 1)) expand(at - 1);
+        collapsed.insert(collapsed.begin() + at, count, 0);
+        visible.insert(at, std::vector<int>(count, 1));
+    }
+    
+    void erase_rows(int at, int count)
+    {
+        if (!folding()) return;
+        for (int r = at; r < at + count; r++) {
+            if (!is_visible(r) || is_collapsed(r)) reveal(r);
+        }
+        collapsed.erase(collapsed.begin() + at, collapsed.begin() + at + count);
+        visible.erase(at, count);
+    }
+    
+    void reshape_row(int row)
+    {
+        if (folding() && (!is_visible(row) || is_collapsed(row))) reveal(row);
+    }
+    
+    // screen rows <-> file rows. The row past the end (where the cursor can sit) counts as shown.
+    int visible_index(int row) 
+    { 
+        if (!folding()) return row;
+        return (int)visible.prefix(std::min(row, index->size())) + std::max(0, row - index->size()); 
+    }
+    int row_at(int position) 
+    { 
+        if (!folding()) return position;
+        long long shown = visible.total();
+        return position < shown ? visible.find(position) : index->size() + (int)(position - shown); 
+    }
+    int visible_count() { return folding() ? (int)visible.total() : index->size(); }
+    int next_visible(int row) { return row_at(visible_index(row) + 1); }
+    int prev_visible(int row) { int position = visible_index(row); return position > 0 ? row_at(position - 1) : -1; }
+    int hidden_after(int row) { return next_visible(row) - row - 1; }  // how many rows a closed fold hides
+};
+
+//==========================================================================================================
+/**** TextBuffer Class ****/
+//==========================================================================================================
+class TextBuffer 
+{
+private:
+    // One slot per row. A hot row owns its EditorRow (text and render); a cold row is only where its text sits
+    // in the cold blocks, so the millions of rows nobody looks at cost 16 bytes each plus their compressed text.
+    struct RowSlot
+    {
+        std::unique_ptr<EditorRow> hot;
+        uint32_t block, line;   // while cold: line <line> of blocks[block]
+    };
+    std::vector<RowSlot> rows;
+    int changes;
+    std::string filename;    
+    struct stat disk_stat;   // what the file on disk looked like the last time we read or wrote it
+    
+    // Cold rows: rows that haven't been drawn or edited for a while are kept compressed, COLD_BLOCK_ROWS at a
+    // time, and decompressed again when someone asks for them
+    unsigned frame;          // bumped once per screen refresh, rows remember the last frame they were used in
+    int warmed_rows;         // rows thawed or created since the last freeze sweep
+    std::vector<ColdBlock> blocks;       // the ids in RowSlot::block index this
+    std::vector<uint32_t> free_blocks;   // ids of blocks whose rows all went hot or away, reused first
+    mutable int unpacked_block;                               // the most recently decompressed block...
+    mutable std::string unpacked_text;                        // ...its text...
+    mutable std::vector<std::string_view> unpacked_lines;     // ...and its lines, pointing into the text
+    
+    // Document statistics: per row byte, char and word counts in prefix-sum trees, kept up to date by every
+    // edit, so offsets and totals never need a walk over the rows. The fold index rides along the same way, and
+    // passes the edits on to the windows' fold views.
+    struct RowInfo
+    {
+        int bytes, chars, words;
+        FoldIndex::RowShape shape;
+    };
+    FenwickTree row_bytes, row_chars, row_words;
+    FoldIndex folds;
+    
+    static RowInfo scan_row(std::string_view text)
+    {
+        RowInfo info{(int)text.size() + 1, 1, 0, FoldIndex::shape_of(text)};  // +1 for the '\n' every row is saved with
+        bool in_word = false;
+        for (unsigned char c : text) 
+        {
+            if ((c & 0xC0) != 0x80) info.chars++;  // count UTF-8 lead bytes only
+            bool space = std::isspace(c);
+            if (!space && !in_word) info.words++;
+            in_word = !space;
+        }
+        return info;
+    }
+    
+    void set_row_info(int index, const RowInfo& info)
+    {
+        row_bytes.set(index, info.bytes);
+        row_chars.set(index, info.chars);
+        row_words.set(index, info.words);
+        if (folds.shape(index) != info.shape) 
+        {
+            for (FoldView* view : folds.get_views()) { view->reshape_row(index); }
+            folds.update(index, info.shape);
+        }
+    }
+    
+    void rescan(int index) { set_row_info(index, scan_row(row_text(index))); }
+    
+    void insert_row_info(int at, const std::vector<RowInfo>& added)
+    {
+        std::vector<int> bytes, chars, words;
+        std::vector<FoldIndex::RowShape> shapes;
+        for (const RowInfo& info : added) 
+        {
+            bytes.push_back(info.bytes);
+            chars.push_back(info.chars);
+            words.push_back(info.words);
+            shapes.push_back(info.shape);
+        }
+        row_bytes.insert(at, bytes);
+        row_chars.insert(at, chars);
+        row_words.insert(at, words);
+        for (FoldView* view : folds.get_views()) { view->insert_rows(at, (int)shapes.size()); }
+        folds.insert(at, shapes);
+    }
+    
+    void erase_row_info(int at, int count)
+    {
+        row_bytes.erase(at, count);
+        row_chars.erase(at, count);
+        row_words.erase(at, count);
+        for (FoldView* view : folds.get_views()) { view->erase_rows(at, count); }
+        folds.erase(at, count);
+    }
+    
+    // the text of a row, without thawing it if it's cold
+    std::string_view row_text(int index) const
+    {
+        const RowSlot& slot = rows[index];
+        if (slot.hot) return slot.hot->get_chars_str();
+        
+        if (unpacked_block != (int)slot.block) 
+        {
+            unpacked_block = slot.block;
+            unpacked_text = LzCodec::decompress(blocks[slot.block].data);
+            unpacked_lines = ColdBlock::unpack_lines(unpacked_text);
+        }
+        return unpacked_lines[slot.line];
+    }
+    
+    // The text of rows [from, to) without thawing them, each cold block decompressed only once (row_text keeps
+    // just one block, which code jumping around the rows would decompress over and over). <unpacked> holds the
+    // decompressed blocks the views point into.
+    std::vector<std::string_view> row_texts(int from, int to, std::deque<std::string>& unpacked) const
+    {
+        std::unordered_map<uint32_t, std::vector<std::string_view>> lines;
+        std::vector<std::string_view> texts;
+        texts.reserve(std::max(to - from, 0));
+        for (int i = from; i < to; i++) 
+        {
+            const RowSlot& slot = rows[i];
+            if (slot.hot) 
+            {
+                texts.push_back(slot.hot->get_chars_str());
+                continue;
+            }
+            auto found = lines.find(slot.block);
+            if (found == lines.end()) 
+            {
+                unpacked.push_back(LzCodec::decompress(blocks[slot.block].data));
+                found = lines.emplace(slot.block, ColdBlock::unpack_lines(unpacked.back())).first;
+            }
+            texts.push_back(found->second[slot.line]);
+        }
+        return texts;
+    }
+    
+    // the row, decompressed if needed, and marked as just used. Everything that reads or edits a row goes through here.
+    EditorRow& hot_row(int index)
+    {
+        RowSlot& slot = rows[index];
+        if (!slot.hot) 
+        {
+            slot.hot = std::make_unique<EditorRow>(std::string(row_text(index)));
+            release_block(slot.block);
+            warmed_rows++;
+        }
+        slot.hot->mark_used(frame);
+        return *slot.hot;
+    }
+    
+    // stores <text> (lines packed with ColdBlock::pack_line) as a new block of <count> cold rows, returns its id
+    uint32_t add_block(const std::string& text, int count)
+    {
+        ColdBlock block{LzCodec::compress(text), text.size(), count};
+        if (free_blocks.empty()) 
+        {
+            blocks.push_back(std::move(block));
+            return (uint32_t)blocks.size() - 1;
+        }
+        uint32_t id = free_blocks.back();
+        free_blocks.pop_back();
+        blocks[id] = std::move(block);
+        return id;
+    }
+    
+    // one row of the block went hot or away, the last one frees it
+    void release_block(uint32_t id)
+    {
+        if (--blocks[id].live_rows > 0) return;
+        std::string().swap(blocks[id].data);
+        free_blocks.push_back(id);
+        if (unpacked_block == (int)id) unpacked_block = -1;  // the id can be handed out again
+    }
+    
+    void erase_rows(int from, int to)
+    {
+        for (int i = from; i < to; i++) {
+            if (!rows[i].hot) release_block(rows[i].block);
+        }
+        rows.erase(rows.begin() + from, rows.begin() + to);
+    }
+    
+    // debug builds check that a new block gives back exactly the rows it was made from, whatever bytes they hold
+    bool round_trips(const ColdBlock& block, int from, int to) const
+    {
+        std::string text = LzCodec::decompress(block.data);
+        std::vector<std::string_view> lines = ColdBlock::unpack_lines(text);
+        if ((int)lines.size() != to - from) return false;
+        for (int i = from; i < to; i++) {
+            if (lines[i - from] != rows[i].hot->get_chars_str()) return false;
+        }
+        return true;
+    }
+    
+    // compresses rows [from, to) into one block, they must all be hot
+    void freeze_run(int from, int to)
+    {
+        std::string text;
+        for (int i = from; i < to; i++) { ColdBlock::pack_line(text, rows[i].hot->get_chars_str()); }
+        uint32_t block = add_block(text, to - from);
+        assert(round_trips(blocks[block], from, to));
+        for (int i = from; i < to; i++) { rows[i] = RowSlot{nullptr, block, (uint32_t)(i - from)}; }
+    }
+    
+    // appends <count> rows that start out cold, <text> holds their lines packed with ColdBlock::pack_line
+    void append_cold_rows(const std::string& text, int count)
+    {
+        uint32_t block = add_block(text, count);
+        for (int i = 0; i < count; i++) { rows.push_back(RowSlot{nullptr, block, (uint32_t)i}); }
+    }
+    
+    // compresses every run of rows that hasn't been drawn or edited for COLD_AFTER_FRAMES frames
+    void freeze_cold_rows()
+    {
+        int n = (int)rows.size();
+        int run_start = -1;
+        for (int i = 0; i <= n; i++) 
+        {
+            bool stale = i < n && rows[i].hot && frame - rows[i].hot->get_last_used() >= COLD_AFTER_FRAMES;
+            if (stale && run_start == -1) run_start = i;
+            
+            int run_end = stale ? i + 1 : i;
+            if (run_start != -1 && (!stale || run_end - run_start == COLD_BLOCK_ROWS)) 
+            {
+                if (run_end - run_start >= COLD_MIN_RUN) freeze_run(run_start, run_end);
+                run_start = -1;
+            }
+        }
+        warmed_rows = 0;
+    }
+    
+    void remember_disk_state()
+    {
+        if (stat(filename.c_str(), &disk_stat) == -1) { disk_stat = {}; }
+    }
+    
+    static std::vector<std::string> read_lines(std::ifstream& file)
+    {
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line)) 
+        {
+            // Remove \r if present 
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            lines.push_back(std::move(line));
+        }
+        return lines;
+    }
+    
+    // Replaces rows [at, at + old_len) with lines [from, from + new_len), reusing the rows in place where it can
+    void splice_rows(int at, int old_len, const std::vector<std::string>& lines, int from, int new_len)
+    {
+        int common = std::min(old_len, new_len);
+        warmed_rows += new_len;
+        for (int i = 0; i < common; i++) {
+            if (!rows[at + i].hot) release_block(rows[at + i].block);
+            rows[at + i].hot = std::make_unique<EditorRow>(lines[from + i]);
+            rescan(at + i);
+        }
+        if (old_len > common) {
+            erase_rows(at + common, at + old_len);
+            erase_row_info(at + common, old_len - common);
+        }
+        else if (new_len > common) {
+            std::vector<RowSlot> added;
+            std::vector<RowInfo> counts;
+            added.reserve(new_len - common);
+            for (int i = common; i < new_len; i++) 
+            { 
+                added.push_back(RowSlot{std::make_unique<EditorRow>(lines[from + i]), 0, 0}); 
+                counts.push_back(scan_row(lines[from + i]));
+            }
+            rows.insert(rows.begin() + at + common, std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+            insert_row_info(at + common, counts);
+        }
+    }
+    
+    // A line diff (Myers' O(ND) algorithm) between the current rows and the new lines. Returns the changed
+    // regions as {old_start, old_len, new_start, new_len}, top to bottom.
+    std::vector<std::array<int, 4>> diff_lines(const std::vector<std::string>& lines) const
+    {
+        int old_n = (int)rows.size(), new_n = (int)lines.size();
+        
+        // skip the common head and tail first, most external edits only touch a small part of the file
+        int lo = 0;
+        while (lo < old_n && lo < new_n && row_text(lo) == lines[lo]) { lo++; }
+        int old_hi = old_n, new_hi = new_n;
+        while (old_hi > lo && new_hi > lo && row_text(old_hi - 1) == lines[new_hi - 1]) { old_hi--; new_hi--; }
+        
+        std::vector<std::array<int, 4>> hunks;
+        int n = old_hi - lo, m = new_hi - lo;
+        if (n == 0 && m == 0) return hunks;
+        
+        std::deque<std::string> unpacked;
+        std::vector<std::string_view> old_rows = row_texts(lo, old_hi, unpacked);  // the search compares them in any order
+        auto same = [&](int x, int y) { return old_rows[x] == lines[lo + y]; };
+        
+        int max_d = std::min(n + m, RELOAD_DIFF_LIMIT);
+        int off = max_d + 1;
+        std::vector<int> v(2 * max_d + 3, 0);
+        std::vector<std::vector<int>> trace;
+        int found = -1;
+        
+        for (int d = 0; d <= max_d && found == -1; d++)
+        {
+            trace.push_back(v);
+            for (int k = -d; k <= d; k += 2)
+            {
+                int x = (k == -d || (k != d && v[off + k - 1] < v[off + k + 1])) ? v[off + k + 1] : v[off + k - 1] + 1;
+                int y = x - k;
+                while (x < n && y < m && same(x, y)) { x++; y++; }
+                v[off + k] = x;
+                if (x >= n && y >= m) { found = d; break; }
+            }
+        }
+        
+        if (found == -1)  // too different, just replace the whole middle
+        {
+            hunks.push_back({lo, n, lo, m});
+            return hunks;
+        }
+        
+        // walk the trace backwards collecting the matched (unchanged) line pairs
+        std::vector<std::pair<int, int>> matches;
+        int x = n, y = m;
+        for (int d = found; d >= 0; d--)
+        {
+            const std::vector<int>& vd = trace[d];
+            int k = x - y;
+            int prev_x = 0, prev_y = 0;
+            if (d > 0)
+            {
+                int prev_k = (k == -d || (k != d && vd[off + k - 1] < vd[off + k + 1])) ? k + 1 : k - 1;
+                prev_x = vd[off + prev_k];
+                prev_y = prev_x - prev_k;
+            }
+            while (x > prev_x && y > prev_y) { x--; y--; matches.push_back({x, y}); }
+            x = prev_x;
+            y = prev_y;
+        }
+        std::reverse(matches.begin(), matches.end());
+        matches.push_back({n, m});  // sentinel, closes the last region
+        
+        int px = 0, py = 0;
+        for (const auto& match : matches)
+        {
+            if (match.first > px || match.second > py) {
+                hunks.push_back({lo + px, match.first - px, lo + py, match.second - py});
+            }
+            px = match.first + 1;
+            py = match.second + 1;
+        }
+        return hunks;
+    }
+    
+public:
+    TextBuffer() : changes(0), disk_stat{}, frame(0), warmed_rows(0), unpacked_block(-1) {}
+    
+    
+    void insert_row(int at, const std::string& s) 
+    {
+        if (at < 0 || at > (int)rows.size()) { return; }
+        // std::vector handles reallocation (realloc) and shifting (memmove)
+        rows.insert(rows.begin() + at, RowSlot{std::make_unique<EditorRow>(s), 0, 0});
+        insert_row_info(at, {scan_row(s)});
+        rows[at].hot->mark_used(frame);
+        warmed_rows++;
+        changes++;
+    }
+    
+    void insert_char(int row, int col, int c) 
+    {
+        if (row < 0 || row >= (int)rows.size()) { return; }
+        hot_row(row).insert_char(col, c);
+        rescan(row);
+        changes++;
+    }
+    
+    void delete_char(int row, int col) 
+    {
+        if (row < 0 || row >= (int)rows.size()) { return; }
+        hot_row(row).delete_char(col);
+        rescan(row);
+        changes++;
+    }
+    
+    // Applies the same edit to every row in [top, bottom]: the chars in [left, right) are replaced with <text>.
+    // Rows too short to reach <left> are left alone. The whole block counts as one change, and big blocks are
+    // split across threads since every row is independent.
+    void edit_block(int top, int bottom, int left, int right, const std::string& text)
+    {
+        top = std::max(top, 0);
+        bottom = std::min(bottom, (int)rows.size() - 1);
+        if (top > bottom || left < 0 || right < left) return;
+        for (int i = top; i <= bottom; i++) { hot_row(i); }  // decompress up front, the workers only touch hot rows
+        
+        int count = bottom - top + 1;
+        std::vector<RowInfo> counts(count);
+        auto edit_range = [this, left, right, top, &text, &counts](int from, int to) 
+        {
+            for (int i = from; i < to; i++) 
+            { 
+                rows[i].hot->replace(left, right - left, text); 
+                counts[i - top] = scan_row(rows[i].hot->get_chars_str());
+            }
+        };
+        
+        int workers = std::min((int)std::thread::hardware_concurrency(), count / BLOCK_EDIT_THREAD_ROWS);
+        if (workers <= 1) 
+        {
+            edit_range(top, bottom + 1);
+        }
+        else
+        {
+            std::vector<std::thread> threads;
+            int chunk = (count + workers - 1) / workers;
+            for (int from = top; from <= bottom; from += chunk) {
+                threads.emplace_back(edit_range, from, std::min(from + chunk, bottom + 1));
+            }
+            for (std::thread& t : threads) { t.join(); }
+        }
+        for (int i = top; i <= bottom; i++) { set_row_info(i, counts[i - top]); }
+        changes++;
+    }
+    
+    // Logic for splitting a line (Enter key)
+    void split_row(int row_idx, int split_at)
+    {
+         if (row_idx < 0 || row_idx >= (int)rows.size()) return;
+         EditorRow& current_row = hot_row(row_idx);
+         std::string row_content = current_row.get_chars_str();
+         std::string next_row_content = "";
+         
+         if(split_at < (int)row_content.size()) {
+             next_row_content = row_content.substr(split_at);
+             current_row.truncate(split_at);
+             rescan(row_idx);
+         }
+         insert_row(row_idx + 1, next_row_content);
+    }
+    
+    // Logic for appending a line to previous (Backspace at start of line)
+    void merge_rows(int row_idx)
+    {
+        if (row_idx <= 0 || row_idx >= (int)rows.size()) return;
+        EditorRow& prev_row = hot_row(row_idx - 1);
+        EditorRow& curr_row = hot_row(row_idx);
+        prev_row.append_string(curr_row.get_chars_str());
+        rescan(row_idx - 1);
+        
+        // Remove the current row
+        erase_rows(row_idx, row_idx + 1);
+        erase_row_info(row_idx, 1);
+        changes++;
+    }
+    
+    void open_file(const std::string& file_name) 
+    {
+        filename = file_name;
+        std::ifstream file(file_name);
+        if (!file.is_open()) 
+        {
+            throw std::runtime_error(std::string("File Read Error:") + std::strerror(errno));
+        }
+        
+        // Clear existing rows if any
+        rows.clear();
+        blocks.clear();
+        free_blocks.clear();
+        unpacked_block = -1;
+        
+        // nothing has been looked at yet, so every row starts out cold: the lines go straight into compressed
+        // blocks, COLD_BLOCK_ROWS at a time, without ever being held (or rendered) in full
+        std::string line, text;
+        std::vector<int> bytes, chars, words;
+        std::vector<FoldIndex::RowShape> shapes;
+        int count = 0;
+        while (std::getline(file, line)) 
+        {
+            // Remove \r if present 
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            RowInfo info = scan_row(line);
+            bytes.push_back(info.bytes);
+            chars.push_back(info.chars);
+            words.push_back(info.words);
+            shapes.push_back(info.shape);
+            
+            ColdBlock::pack_line(text, line);
+            if (++count == COLD_BLOCK_ROWS) 
+            {
+                append_cold_rows(text, count);
+                text.clear();
+                count = 0;
+            }
+        }
+        if (count) append_cold_rows(text, count);
+        row_bytes.assign(std::move(bytes));
+        row_chars.assign(std::move(chars));
+        row_words.assign(std::move(words));
+        folds.assign(std::move(shapes));
+        for (FoldView* view : folds.get_views()) { view->expand_all(); }
+        file.close();
+        warmed_rows = 0;
+        changes = 0;
+        remember_disk_state();
+    }
+    
+    // true if someone other than us has written, replaced or removed the file since we last touched it
+    bool changed_on_disk() const
+    {
+        if (filename.empty()) return false;
+        struct stat st;
+        if (stat(filename.c_str(), &st) == -1) return true;
+        return st.st_ino != disk_stat.st_ino || st.st_size != disk_stat.st_size ||
+               st.st_mtim.tv_sec != disk_stat.st_mtim.tv_sec || st.st_mtim.tv_nsec != disk_stat.st_mtim.tv_nsec;
+    }
+    
+    // Re-reads the file and splices in only the regions that differ, rows outside of them (and their
+    // rendered text) are left untouched. Returns the number of changed regions, or -1 if the file can't be read.
+    int reload()
+    {
+        std::ifstream file(filename);
+        if (!file.is_open()) return -1;
+        std::vector<std::string> lines = read_lines(file);
+        file.close();
+        
+        std::vector<std::array<int, 4>> hunks = diff_lines(lines);
+        for (auto it = hunks.rbegin(); it != hunks.rend(); ++it)  // bottom up, so the earlier row indices stay valid
+        {
+            splice_rows((*it)[0], (*it)[1], lines, (*it)[2], (*it)[3]);
+        }
+        if (!hunks.empty())  // closed folds may no longer match the text
+        {
+            for (FoldView* view : folds.get_views()) { view->expand_all(); }
+        }
+        changes = 0;
+        remember_disk_state();
+        return (int)hunks.size();
+    }
+    
+    std::string rows_to_string() const // reads the row of the files and converts them into strings
+    {
+        std::stringstream ss;
+        for (int i = 0; i < (int)rows.size(); i++) 
+        {
+            ss << row_text(i) << '\n';
+        }
+        return ss.str();
+    }
+    
+    bool save() 
+    {
+        if (filename.empty()) return false;
+        std::string buffer_content = rows_to_string();
+        // open the <filename> with read/write perms, or create it, if it doesn't' exit
+        int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644); 
+        
+        if (fd != -1) 
+        {
+            if (ftruncate(fd, buffer_content.size()) != -1) 
             {
                 if (write(fd, buffer_content.c_str(), buffer_content.size()) == (ssize_t)buffer_content.size()) 
                 {
                     close(fd);
                     changes = 0;
+                    remember_disk_state();  // so our own write doesn't look like an external change
                     return true;
                 }
             }
             close(fd);
         }
-        return false;
+        return false;
+    }
+    
+    int get_num_rows() const { return (int)rows.size(); }
+    int get_changes() const { return changes; }
+    FoldIndex& get_folds() { return folds; }
+    const char* get_filename() const { return filename.empty() ? nullptr : filename.c_str(); }
+    
+    EditorRow* get_row(int index) { 
+        if (index >= 0 && index < (int)rows.size())
+            return &hot_row(index);
+        return nullptr;
+    }
+    
+    long long get_total_bytes() { return row_bytes.total(); }
+    long long get_total_chars() { return row_chars.total(); }
+    long long get_total_words() { return row_words.total(); }
+    
+    long long byte_offset(int row, int col)  // where (row, col) is in the saved file
+    {
+        row = std::clamp(row, 0, (int)rows.size());
+        return row_bytes.prefix(row) + col;
+    }
+    
+    // the (row, col) of a byte offset in the saved file, false if it's past the end
+    bool find_byte(long long offset, int& row, int& col)
+    {
+        if (offset < 0 || offset > row_bytes.total()) return false;
+        row = row_bytes.find(offset);
+        col = (row < (int)rows.size()) ? (int)(offset - row_bytes.prefix(row)) : 0;
+        return true;
+    }
+    
+    // called once per screen refresh; every so often, rows that went unused get compressed again
+    void next_frame()
+    {
+        frame++;
+        if (warmed_rows >= COLD_BLOCK_ROWS && frame % COLD_AFTER_FRAMES == 0) { freeze_cold_rows(); }
+    }
+    
+    struct MemoryStats
+    {
+        int hot_rows, cold_rows;
+        size_t hot_bytes;         // text + render of the hot rows
+        size_t cold_raw_bytes;    // what the live cold blocks hold, uncompressed
+        size_t cold_packed_bytes; // and compressed
+    };
+    
+    MemoryStats memory_stats() const
+    {
+        MemoryStats stats{};
+        for (const RowSlot& slot : rows) 
+        {
+            if (!slot.hot) 
+            {
+                stats.cold_rows++;
+                continue;
+            }
+            stats.hot_rows++;
+            stats.hot_bytes += slot.hot->get_size() + slot.hot->get_render_size();
+        }
+        for (const ColdBlock& block : blocks) 
+        {
+            if (block.live_rows == 0) continue;
+            stats.cold_raw_bytes += block.raw_size;
+            stats.cold_packed_bytes += block.data.size();
+        }
+        return stats;
+    }
+    
+    void reset_changes() { changes = 0; }
+};
+
+//==========================================================================================================
+/**** Window Class ****/
+//==========================================================================================================
+// One view on a TextBuffer: its own cursor, scroll offsets, block selection and closed folds, and its own part
+// of the screen. Any number of windows can show the same TextBuffer, they all share its rows (and the rows' render).
+class Window 
+{
+private:
+    TextBuffer* text_buffer;
+    FoldView folds;
+    
+    int cursor_x, cursor_y;  // the x and y coordinates of the cursor
+    int row_offset;
+    int col_offset;
+    
+    // Block selection: the rectangle between the anchor and the cursor. A zero-width block is a column of
+    // cursors, one per row.
+    bool block_active;
+    int block_anchor_x, block_anchor_y;
+    
+    // Where the window goes on the screen: <height> lines of text starting at <top> (0 based), then its status bar
+    int top, left, height, width;
+    bool right_edge;   // nothing to our right, so a line can be finished with <esc>[K instead of padding
+    bool full_width;   // we span the whole terminal, so a scroll region can move our lines
+    
+    // What our part of the terminal currently shows, so refresh_screen only has to send the difference
+    std::vector<std::string> screen_lines;
+    std::string screen_status;
+    int screen_row_offset;  // the row_offset screen_lines were drawn with, as a visible row index
+    
+    // What line <y> of the window should show (the rows of tildes). <file_row> is the row there once closed
+    // folds are skipped.
+    std::string compose_row(int y, int file_row)
+    {
+        std::string line;
+        int shown = 0;  // how many columns of the window the line covers
+    
+        if (file_row >= text_buffer->get_num_rows())
+        {
+            if (text_buffer->get_num_rows() == 0 && y == height / 3)  // Welcome message
+            {
+                char welcome[80];
+                int welcome_length = snprintf(welcome, sizeof(welcome), "Text editor -- version %s", VERSION);
+                if (welcome_length > width) { welcome_length = width; }
+    
+                int padding = (width - welcome_length) / 2;
+                if (padding) 
+                {
+                    line.append("~");
+                    padding--;
+                }
+                while (padding--) { line.append(" "); }
+                line.append(welcome, welcome_length);
+            }
+            else
+            {
+                line.append("~");
+            }
+            shown = (int)line.size();
+        }
+        else 
+        {
+            EditorRow* row = text_buffer->get_row(file_row);
+            int len = row->get_render_size() - col_offset;
+            if (len < 0) { len = 0; }
+            if (len > width) len = width;
+    
+            // Using std::string logic instead of pointer arithmetic
+            const char* render_ptr = row->get_render();
+            std::string_view visible(len ? render_ptr + col_offset : "", len);
+            shown = len;
+    
+            int left_col = std::min(cursor_x, block_anchor_x), right_col = std::max(cursor_x, block_anchor_x);
+            if (block_active && file_row >= std::min(cursor_y, block_anchor_y) && file_row <= std::max(cursor_y, block_anchor_y) &&
+                row->get_size() >= left_col)  // rows that don't reach the block aren't edited, so don't mark them
+            {
+                // invert the part of the row inside the block (a single cell for a column of cursors)
+                int hl_start = row->cx_to_rx(left_col) - col_offset;
+                int hl_end = (right_col > left_col ? row->cx_to_rx(right_col) : row->cx_to_rx(left_col) + 1) - col_offset;
+                hl_start = std::clamp(hl_start, 0, width);
+                hl_end = std::clamp(hl_end, hl_start, width);
+    
+                std::string padded(visible);
+                if ((int)padded.size() < hl_end) { padded.resize(hl_end, ' '); }
+                line.append(padded, 0, hl_start);
+                line.append("\x1b[7m");
+                line.append(padded, hl_start, hl_end - hl_start);
+                line.append("\x1b[m");
+                line.append(padded, hl_end);
+                shown = (int)padded.size();
+            }
+            else
+            {
+                line.append(visible);
+            }
+            
+            if (folds.is_collapsed(file_row))  // say how much the closed fold hides
+            {
+                char marker[32];
+                int hidden = folds.hidden_after(file_row);
+                int marker_len = snprintf(marker, sizeof(marker), " [+%d %s]", hidden, hidden == 1 ? "line" : "lines");
+                if (shown + marker_len <= width) 
+                {
+                    line.append("\x1b[2m");
+                    line.append(marker, marker_len);
+                    line.append("\x1b[m");
+                    shown += marker_len;
+                }
+            }
+        }
+        if (!right_edge) { line.append(width - shown, ' '); }  // <esc>[K would wipe the window next to us
+        return line;
+    }
+    
+    // Only sends the lines that differ from what the terminal already shows. When row_offset moved by less
+    // than a window, a window spanning the whole width has the terminal scroll its lines (a scroll region +
+    // SU/SD) so just the newly exposed lines have to be drawn.
+    void draw_rows(AppendBuffer* ab)
+    {
+        char buf[48];
+        int top_index = folds.visible_index(row_offset);
+        int delta = top_index - screen_row_offset;
+        if (full_width && delta != 0 && std::abs(delta) < height)
+        {
+            snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", top + 1, top + height, std::abs(delta), delta > 0 ? 'S' : 'T');
+            ab->append(buf);  // set the scroll region to our lines, scroll it, then reset the region
+    
+            if (delta > 0) 
+            {
+                screen_lines.erase(screen_lines.begin(), screen_lines.begin() + delta);
+                screen_lines.resize(height);
+            }
+            else
+            {
+                screen_lines.erase(screen_lines.end() + delta, screen_lines.end());
+                screen_lines.insert(screen_lines.begin(), -delta, std::string());
+            }
+        }
+        screen_row_offset = top_index;
+    
+        for (int y = 0, file_row = row_offset; y < height; y++, file_row = folds.next_visible(file_row))
+        {
+            std::string line = compose_row(y, file_row);
+            if (line == screen_lines[y]) continue;
+    
+            snprintf(buf, sizeof(buf), "\x1b[%d;%dH", top + y + 1, left + 1);
+            ab->append(buf);
+            ab->append(line);
+            if (right_edge) ab->append("\x1b[K"); // erarse the rest of the line
+            screen_lines[y] = std::move(line);
+        }
+    }
+    
+    void draw_status_bar(AppendBuffer* ab, bool active)
+    {
+        char status[80], rstatus[80];
+        // put the filename (if there's any) on the status bar
+        int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
+                           text_buffer->get_filename() ? text_buffer->get_filename() : "[No Name]",
+                           text_buffer->get_num_rows(),
+                           text_buffer->get_changes() ? "(modified)" : "");
+        // show: the cursor's byte offset (and how far into the file that is), the word/byte totals, and
+        // <the row where the cursor is rn>/<total num of rows>. Only the row part if the window is too narrow.
+        long long total_bytes = text_buffer->get_total_bytes();
+        long long offset = text_buffer->byte_offset(cursor_y, cursor_x);
+        int rlen = snprintf(rstatus, sizeof(rstatus), "byte %lld (%lld%%) | %lld words %lld bytes | %d/%d", 
+                            offset, total_bytes ? offset * 100 / total_bytes : 100LL, 
+                            text_buffer->get_total_words(), total_bytes, cursor_y + 1, text_buffer->get_num_rows());
+        if (len > width) { len = width; }
+        if (len + rlen > width) {
+            rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", cursor_y + 1, text_buffer->get_num_rows());
+        }
+    
+        std::string bar(active ? "\x1b[7m" : "\x1b[7;2m"); // invert the colors (from w on b to b on w), dimmed when not active
+        bar.append(status, len);
+        while (len < width)
+        {
+            if (width - len == rlen)  // do this while there is space for rstatus
+            {
+                bar.append(rstatus);
+                break;
+            }
+            else
+            {
+                bar.append(" ");
+                len++;
+            }
+        }
+        bar.append("\x1b[m");  // get the normal colors back
+        if (bar == screen_status) return;
+    
+        char buf[32];
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", top + height + 1, left + 1);
+        ab->append(buf);
+        ab->append(bar);
+        screen_status = std::move(bar);
+    }
+    
+    // One batched edit over every row of the block: the block's contents are replaced with <text>, and the
+    // block collapses into a column of cursors right after it
+    void edit_block(const std::string& text, int left_col, int right_col)
+    {
+        text_buffer->edit_block(std::min(cursor_y, block_anchor_y), std::max(cursor_y, block_anchor_y), left_col, right_col, text);
+        cursor_x = block_anchor_x = left_col + (int)text.size();
+    }
+    
+public:
+    explicit Window(TextBuffer* buffer) : text_buffer(buffer), folds(&buffer->get_folds()),
+                                          cursor_x(0), cursor_y(0), row_offset(0), col_offset(0),
+                                          block_active(false), block_anchor_x(0), block_anchor_y(0),
+                                          top(0), left(0), height(0), width(0), right_edge(true), full_width(true),
+                                          screen_row_offset(0)
+    {
+    }
+    
+    void show(TextBuffer* buffer)  // switch to another buffer, starting at its top
+    {
+        text_buffer = buffer;
+        folds.show(&buffer->get_folds());
+        cursor_x = cursor_y = row_offset = col_offset = 0;
+        block_active = false;
+    }
+    
+    void set_region(int region_top, int region_left, int text_height, int region_width, int screen_cols)
+    {
+        top = region_top;
+        left = region_left;
+        height = std::max(text_height, 1);
+        width = std::max(region_width, 1);
+        right_edge = (left + width >= screen_cols);
+        full_width = (left == 0 && right_edge);
+    }
+    
+    // after the screen was cleared: everything has to be drawn again
+    void forget_screen()
+    {
+        screen_lines.assign(height, std::string());
+        screen_status.clear();
+        screen_row_offset = folds.visible_index(row_offset);
+    }
+    
+    TextBuffer* get_buffer() const { return text_buffer; }
+    FoldView& get_folds() { return folds; }
+    int get_cursor_x() const { return cursor_x; }
+    int get_cursor_y() const { return cursor_y; }
+    bool is_block_active() const { return block_active; }
+    
+    // Rows are counted the way they're shown: rows inside closed folds don't take up any lines
+    void scroll() 
+    {
+        int cursor_index = folds.visible_index(cursor_y), top_index = folds.visible_index(row_offset);
+        if (cursor_index < top_index)  // whenever the cursor is above the rowoffset
+        {
+            row_offset = cursor_y;  // set offset to the row where the cursor is right now (aka go back)
+        }
+        if (cursor_index >= top_index + height)  // if the cursor is at the last visible line of the window
+        {
+            row_offset = folds.row_at(cursor_index - height + 1);  // set row offset to one plus the difference
+        }
+        if (cursor_x < col_offset) 
+        {
+            col_offset = cursor_x;
+        }
+        if (cursor_x >= col_offset + width)
+        {
+            col_offset = cursor_x - width + 1;
+        }
+    }
+    
+    void draw(AppendBuffer* ab, bool active)
+    {
+        draw_rows(ab);
+        draw_status_bar(ab, active);
+    }
+    
+    void place_cursor(AppendBuffer* ab)
+    {
+        char buf[32];
+        int y = folds.visible_index(cursor_y) - folds.visible_index(row_offset);
+        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", top + y + 1, left + (cursor_x - col_offset) + 1);
+        ab->append(buf);
+    }
+    
+    // the buffer may have changed under us (another window, a reload, a fold closing): keep the cursor inside
+    // it, and on a row that's shown
+    void clamp_cursor()
+    {
+        if (cursor_y > text_buffer->get_num_rows()) { cursor_y = text_buffer->get_num_rows(); }
+        if (!folds.is_visible(cursor_y)) { cursor_y = folds.prev_visible(cursor_y); }  // the closed fold's first row
+        if (!folds.is_visible(row_offset)) { row_offset = folds.prev_visible(row_offset); }
+        if (block_anchor_y >= text_buffer->get_num_rows()) { block_anchor_y = std::max(text_buffer->get_num_rows() - 1, 0); }
+        if (block_active) return;  // a block may reach past the end of short rows
+        EditorRow* row = text_buffer->get_row(cursor_y);
+        int row_length = row ? row->get_size() : 0; 
+        if (cursor_x > row_length) { cursor_x = row_length; }
+    }
+    
+    // Another window inserted (<delta> > 0) or removed rows of our buffer at <at>: follow the text we were on
+    void rows_moved(int at, int delta)
+    {
+        auto follow = [at, delta](int& y) { if (y >= at) y = std::max(y + delta, std::max(at - 1, 0)); };
+        follow(cursor_y);
+        follow(row_offset);
+        follow(block_anchor_y);
+    }
+    
+    // Up/down (and wrapping left/right) go to the previous/next row that's shown, stepping over closed folds
+    void move_cursor(int key) 
+    {
+        EditorRow* row = (cursor_y >= text_buffer->get_num_rows()) ? nullptr : text_buffer->get_row(cursor_y);
+    
+        switch (key) 
+        {
+            case (int)Key::ARROW_LEFT:
+                if (cursor_x != 0) 
+                {
+                    cursor_x--;
+                }
+                else if (cursor_y > 0)  // move to end of previous line
+                {
+                    cursor_y = folds.prev_visible(cursor_y);
+                    cursor_x = text_buffer->get_row(cursor_y)->get_size();
+                }
+                break;
+            case (int)Key::ARROW_RIGHT:
+                if (row && cursor_x < row->get_size()) 
+                {
+                    cursor_x++;
+                }
+                else if (row && cursor_x == row->get_size())  // move to next line
+                {
+                    cursor_y = folds.next_visible(cursor_y);
+                    cursor_x = 0;
+                }
+                break;
+            case (int)Key::ARROW_UP:
+                if (cursor_y != 0) 
+                {
+                    cursor_y = folds.prev_visible(cursor_y);
+                }
+                break;
+            case (int)Key::ARROW_DOWN:
+                if (cursor_y < text_buffer->get_num_rows())
+                {
+                    cursor_y = folds.next_visible(cursor_y);
+                }
+                break;
+        }
+        // don't let the user move past the last character of each line
+        row = (cursor_y >= text_buffer->get_num_rows()) ? nullptr : text_buffer->get_row(cursor_y);
+        int row_length = row ? row->get_size() : 0; 
+        if (cursor_x > row_length) 
+        {
+            cursor_x = row_length;
+        }
+    }
+    
+    void jump_to(int row, int col)
+    {
+        folds.reveal(row);
+        cursor_y = row;
+        cursor_x = col;
+        block_active = false;
+    }
+    
+    // opens the closed fold at the cursor, or closes the one the cursor is in (moving onto its first row)
+    bool toggle_fold()
+    {
+        int header = folds.fold_at(cursor_y);
+        if (header < 0) return false;
+        if (folds.is_collapsed(header)) 
+        {
+            folds.expand(header);
+        }
+        else
+        {
+            folds.collapse(header);
+            cursor_y = header;
+        }
+        return true;
+    }
+    
+    void home() { cursor_x = 0; }  // move the cursor at the beginning of the line
+    
+    void end()
+    {
+        if (cursor_y < text_buffer->get_num_rows())
+            cursor_x = text_buffer->get_row(cursor_y)->get_size();
+    }
+    
+    void page(int key)
+    {
+        if (key == (int)Key::PAGE_UP)
+        {
+            cursor_y = row_offset;
+        }
+        else if (key == (int)Key::PAGE_DOWN)
+        {
+            cursor_y = folds.row_at(folds.visible_index(row_offset) + height - 1);
+            if (cursor_y > text_buffer->get_num_rows()) cursor_y = text_buffer->get_num_rows();
+        }
+        int times = height;
+        while (times--)  // While as long as we don't reach the top of the window
+            move_cursor(key == (int)Key::PAGE_UP ? (int)Key::ARROW_UP : (int)Key::ARROW_DOWN);
+    }
+    
+    void insert_char(int c) 
+    {
+        if (cursor_y == text_buffer->get_num_rows())  // if the cursor's at the end of the line
+        {
+            text_buffer->insert_row(text_buffer->get_num_rows(), "");
+        }
+        folds.reveal(cursor_y);  // typing on a closed fold's first row opens it
+        text_buffer->insert_char(cursor_y, cursor_x, c);
+        cursor_x++;
+    }
+    
+    void delete_char() 
+    {
+        if (cursor_y == text_buffer->get_num_rows()) { return; }
+    
+        if (cursor_x > 0) 
+        {
+            folds.reveal(cursor_y);
+            text_buffer->delete_char(cursor_y, cursor_x - 1);
+            cursor_x--;
+        }
+        else if (cursor_x == 0 && cursor_y > 0) // Handle merge lines (Backspace at start)
+        {
+            folds.reveal(cursor_y - 1);  // the row we join may be the end of a closed fold above
+            folds.reveal(cursor_y);
+            cursor_x = text_buffer->get_row(cursor_y - 1)->get_size();
+            text_buffer->merge_rows(cursor_y);
+            cursor_y--;
+        }
+    }
+    
+    void insert_newline() 
+    {
+        folds.reveal(cursor_y);
+        if (cursor_x == 0)  // if cursor is at the beginning of a line
+        {
+            text_buffer->insert_row(cursor_y, "");  // make space for a new row
+        }
+        else 
+        {
+            // Split the row in the TextBuffer logic, not here in Window
+            text_buffer->split_row(cursor_y, cursor_x);
+        }
+        cursor_y++;
+        cursor_x = 0;
     }
     
-    int get_num_rows() const { return (int)rows.size(); }
-    int get_changes() const { return changes; }
-    const char* get_filename() const { return filename.empty() ? nullptr : filename.c_str(); }
-    
-    EditorRow* get_row(int index) { 
-        if (index >= 0 && index < (int)rows.size())
-            return &rows[index];
-        return nullptr;
+    // Shift+arrows grow/shrink the block. Unlike move_cursor, left/right don't wrap to other lines and up/down
+    // keep the column even on shorter rows, so the block stays a rectangle.
+    void extend_block(int key)
+    {
+        if (!block_active) 
+        {
+            block_active = true;
+            block_anchor_x = cursor_x;
+            block_anchor_y = cursor_y;
+        }
+        switch (key) 
+        {
+            case (int)Key::SHIFT_ARROW_LEFT:
+                if (cursor_x > 0) cursor_x--;
+                break;
+            case (int)Key::SHIFT_ARROW_RIGHT:
+                if (cursor_y < text_buffer->get_num_rows() && cursor_x < text_buffer->get_row(cursor_y)->get_size()) cursor_x++;
+                break;
+            case (int)Key::SHIFT_ARROW_UP:
+                if (cursor_y > 0) cursor_y = folds.prev_visible(cursor_y);
+                break;
+            case (int)Key::SHIFT_ARROW_DOWN:
+                if (folds.next_visible(cursor_y) < text_buffer->get_num_rows()) 
+                    cursor_y = folds.next_visible(cursor_y);
+                break;
+        }
     }
     
-    void reset_changes() { changes = 0; }
+    // keys while a block is active, returns false if the key should get its normal meaning (which ends the block)
+    bool process_block_key(int c)
+    {
+        int left_col = std::min(cursor_x, block_anchor_x), right_col = std::max(cursor_x, block_anchor_x);
+        switch (c) 
+        {
+            case (int)Key::SHIFT_ARROW_UP:
+            case (int)Key::SHIFT_ARROW_DOWN:
+            case (int)Key::SHIFT_ARROW_LEFT:
+            case (int)Key::SHIFT_ARROW_RIGHT:
+                extend_block(c);
+                return true;
+            case (int)Key::BACKSPACE:
+            case ctrl_key('h'):
+                if (right_col > left_col) edit_block("", left_col, right_col);
+                else if (left_col > 0) edit_block("", left_col - 1, left_col);
+                return true;
+            case (int)Key::DEL_KEY:
+                edit_block("", left_col, right_col > left_col ? right_col : left_col + 1);
+                return true;
+            case '\x1b':
+                block_active = false;
+                return true;
+            default:
+                if (c == '\t' || (c >= 32 && c < 127))  // printable: type it into every row
+                {
+                    edit_block(std::string(1, (char)c), left_col, right_col);
+                    return true;
+                }
+                block_active = false;
+                return false;
+        }
+    }
 };
 
 //==========================================================================================================
@@ -440,116 +2394,213 @@ class Editor
 {
 private:
     Terminal terminal;
-    TextBuffer text_buffer;
     
-    int cursor_x, cursor_y;  // the x and y coordinates of the cursor
-    int row_offset;
-    int col_offset;
+    // Every open file (or the unnamed buffer) once, however many windows show it
+    struct OpenBuffer
+    {
+        TextBuffer text;
+        FileWatcher watcher;
+    };
+    std::vector<std::unique_ptr<OpenBuffer>> buffers;
+    
+    // The windows are the leaves of a tree of splits: an inner node puts its two children side by side
+    // (vertical, with a '|' column between them) or one above the other
+    struct Layout
+    {
+        std::unique_ptr<Window> window;  // only set on leaves
+        bool vertical = false;
+        std::unique_ptr<Layout> first, second;
+        Layout* parent = nullptr;
+    };
+    std::unique_ptr<Layout> layout;
+    Window* active;          // the window that gets the keys
+    bool layout_changed;     // the windows moved, everything has to be drawn again
+    
+    // Session recording/replay (for reproducing latency reports)
+    SessionRecorder recorder;
+    SessionPlayer player;
+    std::string record_path;
+    std::vector<long> frame_us;  // refresh_screen times of this run, kept while replaying
     
     // Status message handling
     std::string statusmsg;
     time_t statusmsg_time;
     int quit_times;
     
-    void scroll() 
+    static void collect_windows(Layout* node, std::vector<Layout*>& leaves)
+    {
+        if (node->window) { leaves.push_back(node); return; }
+        collect_windows(node->first.get(), leaves);
+        collect_windows(node->second.get(), leaves);
+    }
+    
+    std::vector<Layout*> windows() const
+    {
+        std::vector<Layout*> leaves;
+        collect_windows(layout.get(), leaves);
+        return leaves;
+    }
+    
+    Layout* active_leaf() const
+    {
+        for (Layout* leaf : windows()) {
+            if (leaf->window.get() == active) return leaf;
+        }
+        return nullptr;
+    }
+    
+    // hands out the screen area [top, top + rows) x [left, left + cols) to the windows of the subtree, each
+    // window's last line is its status bar. The '|' columns between side by side windows go to <separators>.
+    void place(Layout* node, int top, int left, int rows, int cols, AppendBuffer* separators)
     {
-        if (cursor_y < row_offset)  // whenever the cursor is above the rowoffset
+        if (node->window)
         {
-            row_offset = cursor_y;  // set offset to the row where the cursor is right now (aka go back)
+            node->window->set_region(top, left, rows - 1, cols, terminal.get_screen_cols());
+            return;
         }
-        if (cursor_y >= row_offset + terminal.get_screen_rows() - 2)  // if the cursor is at the last visible line of the editor (-2 for status/message bars)
+        if (node->vertical)
         {
-            row_offset = cursor_y - (terminal.get_screen_rows() - 2) + 1;  // set row offset to one plus the difference
+            int first_cols = (cols - 1) / 2;
+            place(node->first.get(), top, left, rows, first_cols, separators);
+            place(node->second.get(), top, left + first_cols + 1, rows, cols - first_cols - 1, separators);
+    
+            char buf[32];
+            for (int y = 0; y < rows; y++)
+            {
+                snprintf(buf, sizeof(buf), "\x1b[%d;%dH|", top + y + 1, left + first_cols + 1);
+                separators->append(buf);
+            }
         }
-        if (cursor_x < col_offset) 
+        else 
         {
-            col_offset = cursor_x;
+            int first_rows = rows / 2;
+            place(node->first.get(), top, left, first_rows, cols, separators);
+            place(node->second.get(), top + first_rows, left, rows - first_rows, cols, separators);
+        }
+    }
+    
+    void split_window(bool vertical)
+    {
+        Layout* leaf = active_leaf();
+        // every window needs at least a line of text and its status bar, and some columns
+        int rows = terminal.get_screen_rows() - 1, cols = terminal.get_screen_cols();
+        for (Layout* node = leaf->parent, *child = leaf; node; child = node, node = node->parent)
+        {
+            if (node->vertical) cols = (node->first.get() == child) ? (cols - 1) / 2 : cols - (cols - 1) / 2 - 1;
+            else rows = (node->first.get() == child) ? rows / 2 : rows - rows / 2;
         }
-        if (cursor_x >= col_offset + terminal.get_screen_cols()) 
+        if ((vertical && cols < 21) || (!vertical && rows < 4))
         {
-            col_offset = cursor_x - terminal.get_screen_cols() + 1;
+            set_status_message("Not enough room to split");
+            return;
         }
+    
+        // the leaf becomes the split, holding the old window and a copy of it (same buffer, same place)
+        auto first = std::make_unique<Layout>();
+        auto second = std::make_unique<Layout>();
+        first->window = std::move(leaf->window);
+        second->window = std::make_unique<Window>(*first->window);
+        first->parent = second->parent = leaf;
+        leaf->vertical = vertical;
+        leaf->first = std::move(first);
+        leaf->second = std::move(second);
+        active = leaf->second->window.get();
+        layout_changed = true;
     }
     
-    void draw_rows(AppendBuffer* ab)  // The rows of tildes
+    void close_window()
     {
-        int y;
-        for (y = 0; y < terminal.get_screen_rows() - 2; y++)  // -2 for status bar and message bar 
+        Layout* leaf = active_leaf();
+        Layout* parent = leaf->parent;
+        if (!parent)
         {
-            int file_row = y + row_offset;
-            
-            if (file_row >= text_buffer.get_num_rows()) 
-            {
-                if (text_buffer.get_num_rows() == 0 && y == (terminal.get_screen_rows() - 2) / 3)  // Welcome message
-                {
-                    char welcome[80];
-                    int welcome_length = snprintf(welcome, sizeof(welcome), "Text editor -- version %s", VERSION);
-                    if (welcome_length > terminal.get_screen_cols()) { welcome_length = terminal.get_screen_cols(); } 
-                  
-                    int padding = (terminal.get_screen_cols() - welcome_length) / 2;
-                    if (padding) 
-                    {
-                        ab->append("~");
-                        padding--;
-                    }
-                    while (padding--) { ab->append(" "); }
-                    ab->append(welcome);
-                }
-                else
-                {
-                    ab->append("~");
-                }
-            }
-            else 
-            {
-                EditorRow* row = text_buffer.get_row(file_row);
-                int len = row->get_render_size() - col_offset;
-                if (len < 0) { len = 0; }
-                if (len > terminal.get_screen_cols()) len = terminal.get_screen_cols();
-                
-                // Using std::string logic instead of pointer arithmetic
-                const char* render_ptr = row->get_render();
-                ab->append(std::string_view(render_ptr + col_offset, len));
-            }
-            ab->append("\x1b[K"); // erarse each line before painting
-            ab->append("\r\n");
+            set_status_message("Can't close the last window");
+            return;
         }
+        // the sibling takes the parent's place
+        std::unique_ptr<Layout> sibling = std::move(parent->first.get() == leaf ? parent->second : parent->first);
+        parent->window = std::move(sibling->window);
+        parent->vertical = sibling->vertical;
+        parent->first = std::move(sibling->first);
+        parent->second = std::move(sibling->second);
+        if (parent->first) { parent->first->parent = parent->second->parent = parent; }
+    
+        active = windows().front()->window.get();
+        layout_changed = true;
     }
     
-    void draw_status_bar(AppendBuffer* ab) 
+    void next_window()
     {
-        ab->append("\x1b[7m"); // invert the colors (from w on b to b on w)
-                             
-        char status[80], rstatus[80];
-        // put the filename (if there's any) on the status bar
-        int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
-                           text_buffer.get_filename() ? text_buffer.get_filename() : "[No Name]", 
-                           text_buffer.get_num_rows(), 
-                           text_buffer.get_changes() ? "(modified)" : "");
-        // show: the row where the cursor is rn>/<total num of rows>
-        int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", cursor_y + 1, text_buffer.get_num_rows());
-        if (len > terminal.get_screen_cols()) { len = terminal.get_screen_cols(); }
-            
-        ab->append(status);
-        while (len < terminal.get_screen_cols()) 
+        std::vector<Layout*> leaves = windows();
+        for (size_t i = 0; i < leaves.size(); i++)
         {
-            if (terminal.get_screen_cols() - len == rlen)  // do this while there is space for rstatus
+            if (leaves[i]->window.get() == active)
             {
-                ab->append(rstatus);
-                break;
+                active = leaves[(i + 1) % leaves.size()]->window.get();
+                return;
             }
-            else 
+        }
+    }
+    
+    void cycle_buffer(int step)
+    {
+        int count = (int)buffers.size();
+        for (int i = 0; i < count; i++)
+        {
+            if (&buffers[i]->text == active->get_buffer())
             {
-                ab->append(" ");
-                len++;
+                active->show(&buffers[((i + step) % count + count) % count]->text);
+                return;
             }
         }
-        ab->append("\x1b[m");  // get the normal colors back
-        ab->append("\r\n"); // add a new line (to print status messages)
+    }
+    
+    // The buffer for <filename>: the one already open if there is one (the same file, however the path is
+    // spelled), else it's loaded (into the unnamed empty buffer we start with, if that's still untouched).
+    // Nothing changes if the file can't be read.
+    TextBuffer* load_buffer(const std::string& filename)
+    {
+        struct stat st;
+        bool exists = stat(filename.c_str(), &st) == 0;
+        for (auto& buffer : buffers) 
+        {
+            const char* open_name = buffer->text.get_filename();
+            if (!open_name) continue;
+            struct stat open_st;
+            if (exists && stat(open_name, &open_st) == 0 && open_st.st_dev == st.st_dev && open_st.st_ino == st.st_ino) return &buffer->text;
+            if (filename == open_name) return &buffer->text;
+        }
+        
+        TextBuffer loaded;
+        loaded.open_file(filename);  // throws before anything of ours was touched
+        
+        OpenBuffer* target = nullptr;
+        for (auto& buffer : buffers) {
+            if (!buffer->text.get_filename() && buffer->text.get_num_rows() == 0 && !buffer->text.get_changes()) target = buffer.get();
+        }
+        if (!target)
+        {
+            buffers.push_back(std::make_unique<OpenBuffer>());
+            target = buffers.back().get();
+        }
+        target->text = std::move(loaded);  // in place: windows already showing the unnamed buffer keep pointing at it
+        target->watcher.watch(filename);
+        return &target->text;
+    }
+    
+    // Windows showing the same buffer as the active one follow the rows it inserted or removed
+    void rows_moved(int at, int delta)
+    {
+        for (Layout* leaf : windows()) {
+            if (leaf->window.get() != active && leaf->window->get_buffer() == active->get_buffer()) leaf->window->rows_moved(at, delta);
+        }
     }
     
     void draw_message_bar(AppendBuffer* ab) 
     {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "\x1b[%d;1H", terminal.get_screen_rows());
+        ab->append(buf);
         ab->append("\x1b[K");
         int msglen = statusmsg.length();
         if (msglen > terminal.get_screen_cols()) { msglen = terminal.get_screen_cols(); }
@@ -559,116 +2610,156 @@ private:
     
     void refresh_screen() 
     {
-        scroll();
+        auto started = std::chrono::steady_clock::now();
+        std::vector<Layout*> leaves = windows();
         AppendBuffer ab;
         ab.append("\x1b[?25l"); // hides the cursor
-        ab.append("\x1b[H");  // Moves the cursor at the top-left of the terminal
-        draw_rows(&ab);
-        draw_status_bar(&ab);
+    
+        if (layout_changed)  // first frame, new split, or redraw forced: start from a blank screen
+        {
+            AppendBuffer separators;
+            place(layout.get(), 0, 0, terminal.get_screen_rows() - 1, terminal.get_screen_cols(), &separators);  // -1 for the message bar
+            ab.append("\x1b[2J");
+            ab.append(std::string_view(separators.data(), separators.length()));
+            for (Layout* leaf : leaves) { leaf->window->forget_screen(); }
+            layout_changed = false;
+        }
+    
+        for (Layout* leaf : leaves)
+        {
+            leaf->window->clamp_cursor();
+            leaf->window->scroll();
+            leaf->window->draw(&ab, leaf->window.get() == active);
+        }
         draw_message_bar(&ab);
-        
-        char buf[32];
-        snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (cursor_y - row_offset) + 1, (cursor_x - col_offset) + 1);
-        ab.append(buf);
+    
+        active->place_cursor(&ab);
         ab.append("\x1b[?25h"); // shows the cursor
         terminal.write_output(ab.data(), ab.length());
+        for (auto& buffer : buffers) { buffer->text.next_frame(); }
+    
+        long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        if (recorder.is_open()) recorder.frame(us, ab.length());
+        if (player.is_active()) frame_us.push_back(us);
     }
     
-    void move_cursor(int key) 
+    // asks for a line of input on the message bar, returns "" if cancelled with <esc>
+    std::string prompt(const char* fmt)
     {
-        EditorRow* row = (cursor_y >= text_buffer.get_num_rows()) ? nullptr : text_buffer.get_row(cursor_y);
-        
-        switch (key) 
+        std::string input;
+        while (1)
         {
-            case (int)Key::ARROW_LEFT:
-                if (cursor_x != 0) 
-                {
-                    cursor_x--;
-                }
-                else if (cursor_y > 0)  // move to end of previous line
-                {
-                    cursor_y--;
-                    cursor_x = text_buffer.get_row(cursor_y)->get_size();
-                }
-                break;
-            case (int)Key::ARROW_RIGHT:
-                if (row && cursor_x < row->get_size()) 
-                {
-                    cursor_x++;
-                }
-                else if (row && cursor_x == row->get_size())  // move to next line
-                {
-                    cursor_y++;
-                    cursor_x = 0;
-                }
-                break;
-            case (int)Key::ARROW_UP:
-                if (cursor_y != 0) 
-                {
-                    cursor_y--;
-                }
-                break;
-            case (int)Key::ARROW_DOWN:
-                if (cursor_y < text_buffer.get_num_rows())  
+            set_status_message(fmt, input.c_str());
+            refresh_screen();
+    
+            int c = terminal.read_key();
+            if (c == (int)Key::DEL_KEY || c == ctrl_key('h') || c == (int)Key::BACKSPACE)
+            {
+                if (!input.empty()) input.pop_back();
+            }
+            else if (c == '\x1b')
+            {
+                set_status_message("");
+                return "";
+            }
+            else if (c == '\r')
+            {
+                if (!input.empty())
                 {
-                    cursor_y++;
+                    set_status_message("");
+                    return input;
                 }
-                break;
-        }
-        // don't let the user move past the last character of each line
-        row = (cursor_y >= text_buffer.get_num_rows()) ? nullptr : text_buffer.get_row(cursor_y);
-        int row_length = row ? row->get_size() : 0; 
-        if (cursor_x > row_length) 
-        {
-            cursor_x = row_length;
+            }
+            else if (c >= 32 && c < 127)
+            {
+                input.push_back((char)c);
+            }
         }
     }
     
-    void insert_char(int c) 
+    void open_prompt()
     {
-        if (cursor_y == text_buffer.get_num_rows())  // if the cursor's at the end of the line
+        std::string filename = prompt("Open: %s (ESC to cancel)");
+        if (filename.empty()) return;
+        try 
         {
-            text_buffer.insert_row(text_buffer.get_num_rows(), "");
+            active->show(load_buffer(filename));
+        }
+        catch (const std::runtime_error& e) 
+        {
+            set_status_message("%s", e.what());
         }
-        text_buffer.insert_char(cursor_y, cursor_x, c);
-        cursor_x++;
     }
     
-    void delete_char() 
+    // moves the cursor to a byte offset in the (saved) file, e.g. one reported by another tool
+    void jump_prompt()
     {
-        if (cursor_y == text_buffer.get_num_rows()) { return; }
+        std::string input = prompt("Go to byte offset: %s (ESC to cancel)");
+        if (input.empty()) return;
         
-        if (cursor_x > 0) 
-        {
-            text_buffer.delete_char(cursor_y, cursor_x - 1);
-            cursor_x--;
-        }
-        else if (cursor_x == 0 && cursor_y > 0) // Handle merge lines (Backspace at start)
+        char* end;
+        long long offset = std::strtoll(input.c_str(), &end, 10);
+        int row, col;
+        if (*end != '\0' || !active->get_buffer()->find_byte(offset, row, col)) 
         {
-            cursor_x = text_buffer.get_row(cursor_y - 1)->get_size();
-            text_buffer.merge_rows(cursor_y);
-            cursor_y--;
+            set_status_message("No byte offset %s in this file", input.c_str());
+            return;
         }
+        active->jump_to(row, col);
     }
     
-    void insert_newline() 
+    // <ctrl-w> followed by: s/v split the window (one above the other / side by side), w to go to the next
+    // window, c closes the window, n/p show the next/previous buffer in it
+    void window_command()
     {
-        if (cursor_x == 0)  // if cursor is at the beginning of a line
+        set_status_message("^W: s/v split, w next window, c close, n/p next/prev buffer");
+        refresh_screen();
+        int c = terminal.read_key();
+        set_status_message("");
+        switch (c) 
         {
-            text_buffer.insert_row(cursor_y, "");  // make space for a new row
+            case 's': split_window(false); break;
+            case 'v': split_window(true); break;
+            case 'w':
+            case ctrl_key('w'): next_window(); break;
+            case 'c':
+            case 'q': close_window(); break;
+            case 'n': cycle_buffer(1); break;
+            case 'p': cycle_buffer(-1); break;
         }
-        else
+    }
+    
+    // <ctrl-f> followed by: f to open/close the fold at the cursor, c to close every fold, o to open them all
+    void fold_command()
+    {
+        set_status_message("^F: f toggle fold, c close all, o open all");
+        refresh_screen();
+        int c = terminal.read_key();
+        set_status_message("");
+        FoldView& folds = active->get_folds();
+        switch (c) 
         {
-            // Split the row in the TextBuffer logic, not here in Editor
-            text_buffer.split_row(cursor_y, cursor_x);
+            case 'f':
+            case ctrl_key('f'): 
+                if (!active->toggle_fold()) set_status_message("No fold here");
+                break;
+            case 'c': folds.collapse_all(); break;
+            case 'o': folds.expand_all(); break;
         }
-        cursor_y++;
-        cursor_x = 0;
+    }
+    
+    void show_memory_stats()
+    {
+        TextBuffer::MemoryStats stats = active->get_buffer()->memory_stats();
+        double ratio = stats.cold_packed_bytes ? (double)stats.cold_raw_bytes / stats.cold_packed_bytes : 1.0;
+        set_status_message("Rows %d hot/%d cold | hot %zuK | cold %zuK -> %zuK (%.1fx)", 
+                           stats.hot_rows, stats.cold_rows, stats.hot_bytes / 1024,
+                           stats.cold_raw_bytes / 1024, stats.cold_packed_bytes / 1024, ratio);
     }
     
     void save() 
     {
-        if (text_buffer.save()) 
+        if (active->get_buffer()->save())
         {
             set_status_message("File saved successfully");
         }
@@ -678,16 +2769,65 @@ private:
         }
     }
     
+    // called when inotify says something happened in a directory of one of our files
+    void check_disk_changes()
+    {
+        for (auto& buffer : buffers)
+        {
+            TextBuffer& text_buffer = buffer->text;
+            if (!buffer->watcher.consume_events() || !text_buffer.changed_on_disk()) continue;
+    
+            if (text_buffer.get_changes())  // never throw away the user's edits, just tell them
+            {
+                set_status_message("WARNING!!! %.20s changed on disk. Ctrl-S will overwrite it.", text_buffer.get_filename());
+                continue;
+            }
+    
+            // the windows stay where they were, refresh_screen pulls cursors back if their row/column is gone
+            int regions = text_buffer.reload();
+            if (regions < 0)
+            {
+                set_status_message("Can't reload! I/O error: %s", strerror(errno));
+                continue;
+            }
+            if (regions > 0) { set_status_message("Reloaded %d changed region(s) from disk", regions); }
+        }
+    }
+    
+    bool any_unsaved_changes() const
+    {
+        for (const auto& buffer : buffers) {
+            if (buffer->text.get_changes()) return true;
+        }
+        return false;
+    }
+    
     void process_keypress()  // process_keypress() waits for a keypress, and then handles it.
     {
+        std::vector<int> watch_fds;
+        for (const auto& buffer : buffers) { watch_fds.push_back(buffer->watcher.get_fd()); }
+        if (!terminal.wait_for_input(watch_fds))
+        {
+            check_disk_changes();
+            return;
+        }
         int c = terminal.read_key();
+        if (active->is_block_active() && active->process_block_key(c))
+        {
+            quit_times = QUIT_TIMES;
+            return;
+        }
         switch (c) 
         {
             case '\r':
-                insert_newline();
+                {
+                    int at = active->get_cursor_y() + (active->get_cursor_x() > 0 ? 1 : 0);  // the first row that moves down
+                    active->insert_newline();
+                    rows_moved(at, 1);
+                }
                 break;
             case ctrl_key('q'):
-                if (text_buffer.get_changes() && quit_times > 0) 
+                if (any_unsaved_changes() && quit_times > 0)
                 {
                     set_status_message("WARNING!!! File has unsaved changes. Press Ctrl-Q %d more times to quit.", quit_times);
                     quit_times--;
@@ -700,76 +2840,123 @@ private:
             case ctrl_key('s'):
                 save();
                 break;
+            case ctrl_key('g'):
+                show_memory_stats();
+                break;
+            case ctrl_key('o'):
+                open_prompt();
+                break;
+            case ctrl_key('b'):
+                jump_prompt();
+                break;
+            case ctrl_key('w'):
+                window_command();
+                break;
+            case ctrl_key('f'):
+                fold_command();
+                break;
             // Home/End Key operations
             case (int)Key::HOME_KEY:
-                cursor_x = 0;  // move the cursor at the beginning of the line
+                active->home();
                 break;
             case (int)Key::END_KEY:
-                if (cursor_y < text_buffer.get_num_rows())
-                    cursor_x = text_buffer.get_row(cursor_y)->get_size();
+                active->end();
                 break;
             // backspace/del operations
             case (int)Key::BACKSPACE:
             case ctrl_key('h'):
             case (int)Key::DEL_KEY:
-                if (c == (int)Key::DEL_KEY) { move_cursor((int)Key::ARROW_RIGHT); }
-                delete_char();
+                {
+                    if (c == (int)Key::DEL_KEY) { active->move_cursor((int)Key::ARROW_RIGHT); }
+                    int rows_before = active->get_buffer()->get_num_rows();
+                    int at = active->get_cursor_y();
+                    active->delete_char();
+                    if (active->get_buffer()->get_num_rows() < rows_before) rows_moved(at, -1);
+                }
                 break;
             // Page up/down operations
             case (int)Key::PAGE_UP:
             case (int)Key::PAGE_DOWN:
-                {
-                    if (c == (int)Key::PAGE_UP) 
-                    {
-                        cursor_y = row_offset;
-                    }
-                    else if (c == (int)Key::PAGE_DOWN) 
-                    {
-                        cursor_y = row_offset + terminal.get_screen_rows() - 2 - 1;  // -2 for status/message bars
-                        if (cursor_y > text_buffer.get_num_rows()) cursor_y = text_buffer.get_num_rows();
-                    }
-                    int times = terminal.get_screen_rows() - 2;  // -2 for status/message bars
-                    while (times--)  // While as long as we don't reach the top of the screen
-                        move_cursor(c == (int)Key::PAGE_UP ? (int)Key::ARROW_UP : (int)Key::ARROW_DOWN); 
-                }
+                active->page(c);
                 break;
             case (int)Key::ARROW_UP:
             case (int)Key::ARROW_DOWN:
             case (int)Key::ARROW_LEFT:
             case (int)Key::ARROW_RIGHT:
-                move_cursor(c);
+                active->move_cursor(c);
+                break;
+            // Shift+arrows start a block selection
+            case (int)Key::SHIFT_ARROW_UP:
+            case (int)Key::SHIFT_ARROW_DOWN:
+            case (int)Key::SHIFT_ARROW_LEFT:
+            case (int)Key::SHIFT_ARROW_RIGHT:
+                active->extend_block(c);
                 break;
-            // for ctrl+l and an escape sequence
+            // ctrl+l repaints the whole screen, in case it got garbled
             case ctrl_key('l'):
+                layout_changed = true;
+                break;
+            // for an escape sequence
             case '\x1b':
                 break;
             // print characters like a normal texteditor
             default:
-                insert_char(c);
+                active->insert_char(c);
                 break;
         }
         quit_times = QUIT_TIMES;
     }
     
 public:
-    Editor() : cursor_x(0), cursor_y(0), row_offset(0), col_offset(0), 
-               statusmsg_time(0), quit_times(QUIT_TIMES) 
+    Editor() : layout_changed(true), statusmsg_time(0), quit_times(QUIT_TIMES)
     {
+        buffers.push_back(std::make_unique<OpenBuffer>());
+        layout = std::make_unique<Layout>();
+        layout->window = std::make_unique<Window>(&buffers.front()->text);
+        active = layout->window.get();
     }
     
+    // both have to be set up before initialize()
+    void record_session(const std::string& path) { record_path = path; }
+    void replay_session(const std::string& path, bool fast) { player.load(path, fast); }
+    
     void initialize() 
     {
+        terminal.attach_session(record_path.empty() ? nullptr : &recorder, player.is_active() ? &player : nullptr);
         terminal.enter_raw_mode();
-        
+    
         if (!terminal.get_window_size()) 
         {
             throw std::runtime_error(std::string("Failed to get window size: ") + std::strerror(errno));
         }
+        if (!record_path.empty()) recorder.open(record_path, terminal.get_screen_rows(), terminal.get_screen_cols());
     }
     
+    // after a replay: this run's refresh_screen times next to the recorded ones
+    std::string session_report() const
+    {
+        if (!player.is_active()) return "";
+    
+        auto summary = [](std::vector<long> times) 
+        {
+            if (times.empty()) return std::string("no frames");
+            std::sort(times.begin(), times.end());
+            long total = 0;
+            for (long t : times) total += t;
+            char buf[128];
+            snprintf(buf, sizeof(buf), "%zu frames, mean %ld us, p50 %ld us, p99 %ld us, max %ld us", times.size(),
+                     total / (long)times.size(), times[times.size() / 2], times[times.size() * 99 / 100], times.back());
+            return std::string(buf);
+        };
+        return "Replayed " + std::to_string(player.get_key_count()) + " input bytes\n" +
+               "  this run: " + summary(frame_us) + "\n" +
+               "  recorded: " + summary(player.get_recorded_frames()) + "\n";
+    }
+    
+    // the first file goes into the window, any others are opened in the background (<ctrl-w> n/p)
     void open_file(const std::string& filename) 
     {
-        text_buffer.open_file(filename);
+        load_buffer(filename);
     }
     
     void set_status_message(const char* fmt, ...) 
@@ -779,14 +2966,14 @@ public:
         va_start(ap, fmt);
         vsnprintf(buf, sizeof(buf), fmt, ap);
         va_end(ap);
-        
+    
         statusmsg = std::string(buf);
         statusmsg_time = time(NULL);
     }
     
     void run() 
     {
-        set_status_message("Controls: Ctrl-S = Save | Ctrl-Q = quit");
+        set_status_message("Ctrl-S save | Ctrl-Q quit | Ctrl-O open | Ctrl-W windows | Ctrl-F fold");
         try 
         {
           while (1) // run infinitely  
@@ -795,10 +2982,10 @@ public:
               process_keypress();
           }
         }
-
+    
         catch (const std::runtime_error& e) 
         {
-        
+    
           if (std::string(e.what()) != "User quit") 
           {
             throw;  // Re-throw if it's a real error
@@ -810,25 +2997,55 @@ public:
 //==========================================================================================================
 // Main Program Execution
 //==========================================================================================================
+// usage: editor [--record <session>] [--replay <session> [--fast]] [file...]
 int main(int argc, char* argv[]) 
 {
+    std::string report;
     try 
     {
         Editor editor;
+        std::string record_path, replay_path;
+        std::vector<std::string> filenames;
+        bool fast = false;
+        
+        for (int i = 1; i < argc; i++) 
+        {
+            std::string arg(argv[i]);
+            if ((arg == "--record" || arg == "--replay") && i + 1 < argc) 
+            {
+                (arg == "--record" ? record_path : replay_path) = argv[++i];
+            }
+            else if (arg == "--fast") 
+            {
+                fast = true;
+            }
+            else if (arg.rfind("--", 0) == 0) 
+            {
+                throw std::runtime_error("usage: " + std::string(argv[0]) + " [--record <session>] [--replay <session> [--fast]] [file...]");
+            }
+            else 
+            {
+                filenames.push_back(arg);
+            }
+        }
+        
+        if (!replay_path.empty()) editor.replay_session(replay_path, fast);
+        if (!record_path.empty()) editor.record_session(record_path);
         editor.initialize();
         
-        if (argc >= 2) 
+        for (const std::string& filename : filenames) 
         {
-            std::string filename(argv[1]);
             editor.open_file(filename);
         }
         
         editor.run();
+        report = editor.session_report();
     }
     catch (const std::exception& error) 
     {
         std::cerr << error.what() << std::endl;
         return 1;
     }
+    std::cerr << report;  // only once the terminal is back to normal
     return 0;
 }